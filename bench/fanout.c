@@ -0,0 +1,91 @@
+// measure the cost per thread of a fan-out/fan-in workload
+
+// Each round opens a batch of threads doing a little arithmetic while
+// polling nthm_truncated, and the main thread polls them with
+// nthm_busy before reading them, so that the pipes are touched
+// concurrently from both sides as they would be by a drain waiting on
+// its sources. Optional command line arguments are the number of
+// rounds, the number of threads per round, and the number of
+// iterations of arithmetic per thread.
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 256
+#define WIDTH 64
+#define WORK 4096
+
+uintptr_t
+worked (x, err)
+	  uintptr_t *x;
+	  int *err;
+
+	  // Add up some numbers, occasionally checking for truncation.
+{
+  uintptr_t i, total;
+
+  for (total = i = 0; i < *x; total += i++)
+	 if ((i & 0xff) ? 0 : nthm_truncated (err))
+		break;
+  return total;
+}
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  struct nthm_config c;
+  struct timespec start, stop;
+  uintptr_t rounds, width, work, expected, total, i, j, k;
+  nthm_pipe *source;
+  double elapsed;
+  int err;
+
+  err = 0;
+  source = NULL;
+  rounds = (argc > 1) ? strtoul (argv[1], NULL, 10) : ROUNDS;
+  width = (argc > 2) ? strtoul (argv[2], NULL, 10) : WIDTH;
+  work = (argc > 3) ? strtoul (argv[3], NULL, 10) : WORK;
+  if (((! rounds) ? 1 : ! width) ? 1 : ! (source = (nthm_pipe *) calloc (width, sizeof (*source))))
+	 goto a;
+  memset (&c, 0, sizeof (c));
+  c.pipes = c.scopes = width + 1;
+  c.pipe_lists = 2 * width + 1;
+  if (! nthm_init (&c, &err))
+	 goto a;
+  expected = rounds * width * (work ? (work * (work - 1)) >> 1 : 0);
+  total = 0;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; err ? 0 : (i < rounds); i++)
+	 {
+		for (j = 0; err ? 0 : (j < width); j++)
+		  source[j] = nthm_open_copy ((nthm_worker) &worked, &work, sizeof (work), &err);
+		for (k = j = 0; err ? 0 : (k < width); j = (j + 1) % width)
+		  if (source[j] ? (! nthm_busy (source[j], &err)) : 0)
+			 {
+				total += (uintptr_t) nthm_read (source[j], &err);
+				source[j] = NULL;
+				k++;
+			 }
+	 }
+  clock_gettime (CLOCK_MONOTONIC, &stop);
+  if (err ? 1 : (total != expected))
+	 goto a;
+  elapsed = (double) (stop.tv_sec - start.tv_sec) * 1e9 + (double) (stop.tv_nsec - start.tv_nsec);
+  printf ("fanout: %lu rounds of %lu threads, %lu iterations each\n", (unsigned long) rounds, (unsigned long) width, (unsigned long) work);
+  printf ("%.3f s elapsed, %.0f ns per thread\n", elapsed / 1e9, elapsed / (double) (rounds * width));
+  free (source);
+  exit (EXIT_SUCCESS);
+ a: printf (err ? "fanout failed\n%s\n" : "fanout failed\n", nthm_strerror (err));
+  free (source);
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,253 @@
+// measure memory and time costs of large numbers of idle pipes
+
+// A wide tree of idle threads is created to measure the resident
+// memory per pipe and then killed all at once to measure the latency
+// of nthm_kill_all. A deep tree is created to measure the cost per
+// level of opening and tethering a pipe from an already blocked
+// thread. Finally a wide tree of untethered pipes is left unread at
+// exit to measure the time taken to reclaim them. Optional command
+// line arguments are the width and the depth.
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WIDTH 10000
+#define DEPTH 1000
+
+// non-zero when idle threads may finish
+static int opened = 0;
+
+// the number of idle threads waiting for the gate to open
+static uintptr_t arrivals = 0;
+
+// secures mutually exclusive access to the gate and the arrivals
+static pthread_mutex_t gate_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// signaled when the gate opens
+static pthread_cond_t gate_open = PTHREAD_COND_INITIALIZER;
+
+// signaled when an idle thread arrives
+static pthread_cond_t arrived = PTHREAD_COND_INITIALIZER;
+
+// when the exit routine started
+static struct timespec exiting;
+
+
+
+
+static double
+seconds_since (start)
+	  struct timespec *start;
+
+	  // Return the seconds elapsed since the given time.
+{
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+
+
+
+static double
+resident ()
+
+	  // Return the resident set size of the process in bytes.
+{
+  unsigned long size, pages;
+  FILE *f;
+
+  pages = 0;
+  if ((f = fopen ("/proc/self/statm", "r")))
+	 {
+		if (fscanf (f, "%lu %lu", &size, &pages) != 2)
+		  pages = 0;
+		fclose (f);
+	 }
+  return (double) pages * (double) sysconf (_SC_PAGESIZE);
+}
+
+
+
+
+
+static void
+gated (open)
+	  int open;
+
+	  // Open or close the gate, resetting the arrivals when closing it.
+{
+  pthread_mutex_lock (&gate_lock);
+  if (! (opened = open))
+	 arrivals = 0;
+  pthread_cond_broadcast (&gate_open);
+  pthread_mutex_unlock (&gate_lock);
+}
+
+
+
+
+
+static void
+awaited (n)
+	  uintptr_t n;
+
+	  // Wait until n idle threads have arrived.
+{
+  pthread_mutex_lock (&gate_lock);
+  while (arrivals < n)
+	 pthread_cond_wait (&arrived, &gate_lock);
+  pthread_mutex_unlock (&gate_lock);
+}
+
+
+
+
+
+static void *
+idle (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Report arrival and wait for the gate to open.
+{
+  pthread_mutex_lock (&gate_lock);
+  arrivals++;
+  pthread_cond_signal (&arrived);
+  while (! opened)
+	 pthread_cond_wait (&gate_open, &gate_lock);
+  pthread_mutex_unlock (&gate_lock);
+  return NULL;
+}
+
+
+
+
+
+static void *
+deepened (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Open a chain of pipes to the given depth, with an idle thread
+	  // at the end, and block reading from the next one.
+{
+  nthm_pipe source;
+  uintptr_t depth;
+
+  if (! (depth = (uintptr_t) operand))
+	 return idle (operand, err);
+  if ((source = nthm_open (&deepened, (void *) (depth - 1), err)))
+	 nthm_read (source, err);
+  return NULL;
+}
+
+
+
+
+
+static void *
+allocated (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return a result to be reclaimed at exit.
+{
+  return malloc (sizeof (uintptr_t));
+}
+
+
+
+
+
+static void
+exit_began ()
+
+	  // Note the time when the exit routine starts. Registered after
+	  // nthm is initialized, so it runs before nthm's exit routine.
+{
+  clock_gettime (CLOCK_MONOTONIC, &exiting);
+}
+
+
+
+
+
+static void
+exit_ended ()
+
+	  // Report the time taken by the exit routine. Registered before
+	  // nthm is initialized, so it runs after nthm's exit routine.
+{
+  printf ("exit: %.3f s to reclaim untethered unread pipes\n", seconds_since (&exiting));
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  uintptr_t width, depth, i;
+  struct timespec start;
+  nthm_pipe source;
+  double base, t;
+  int err;
+
+  err = 0;
+  width = (argc > 1) ? strtoul (argv[1], NULL, 10) : WIDTH;
+  depth = (argc > 2) ? strtoul (argv[2], NULL, 10) : DEPTH;
+  if (((! width) ? 1 : ! depth) ? 1 : atexit (exit_ended) ? 1 : ! nthm_init (NULL, &err))
+	 goto a;
+  if (atexit (exit_began))
+	 goto a;
+  printf ("scale: width %lu, depth %lu\n", (unsigned long) width, (unsigned long) depth);
+  base = resident ();
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  for (i = 0; err ? 0 : (i < width); i++)
+	 nthm_open (&idle, NULL, &err);
+  if (err)
+	 goto a;
+  awaited (width);
+  t = seconds_since (&start);
+  printf ("wide: %.0f ns per pipe to open and start, %.0f bytes resident per idle pipe\n", t * 1e9 / (double) width, (resident () - base) / (double) width);
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  nthm_kill_all (&err);
+  t = seconds_since (&start);
+  printf ("kill: %.3f ms for nthm_kill_all over %lu pipes\n", t * 1e3, (unsigned long) width);
+  gated (1);
+  nthm_sync (&err);
+  gated (0);
+  base = resident ();
+  clock_gettime (CLOCK_MONOTONIC, &start);
+  if (! (source = nthm_open (&deepened, (void *) depth, &err)))
+	 goto a;
+  awaited (1);
+  t = seconds_since (&start);
+  printf ("deep: %.0f ns per level to open, tether and start, %.0f bytes resident per level\n", t * 1e9 / (double) depth, (resident () - base) / (double) depth);
+  gated (1);
+  nthm_read (source, &err);
+  for (i = 0; err ? 0 : (i < width); i++)
+	 if ((source = nthm_open (&allocated, NULL, &err)))
+		{
+		  nthm_set_destructor (source, &free, &err);
+		  nthm_untether (source, &err);
+		}
+  nthm_sync (&err);
+  if (! err)
+	 exit (EXIT_SUCCESS);
+ a: printf (err ? "scale failed\n%s\n" : "scale failed\n", nthm_strerror (err));
+  exit (EXIT_FAILURE);
+}
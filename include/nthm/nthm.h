@@ -2,13 +2,30 @@
 #ifndef NTHM_H
 #define NTHM_H 1
 
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // range of negative numbers reserved for error codes
 #define NTHM_MIN_ERR 16
-#define NTHM_MAX_ERR 511
+#define NTHM_MAX_ERR 1023
 
 // in 32-bit mode, the stack size in bytes in excess of PTHREAD_STACK_MIN allocated for threads
 #define NTHM_STACK_MIN 16384
 
+// operands up to this many bytes are copied by nthm_open_copy into the pipe without further allocation
+#define NTHM_OPERAND_MAX 32
+
+// on a multiprocessor, the default number of times nthm_read and nthm_select poll for a result before sleeping
+#define NTHM_POLLS 256UL
+
+// policies for disposing of threads left running when nthm_scope_run returns
+#define NTHM_JOIN 0
+#define NTHM_KILL 1
+
 // error codes
 
 #define NTHM_UNMANT (-16)
@@ -23,15 +40,60 @@ typedef void *(*nthm_worker)(void *,int *);   // the type of function passed to
 
 typedef void (*nthm_slacker)(void *);         // the type of function passed to nthm_send
 
+typedef void (*nthm_destructor)(void *);      // the type of function passed to nthm_set_destructor
+
+typedef void (*nthm_notifier)(void *);        // the type of function passed to nthm_notify and nthm_notify_select
+
+typedef void *(*nthm_allocator)(size_t, size_t, void *);   // allocates a given size and alignment, passed to nthm_set_allocator
+
+typedef void (*nthm_deallocator)(void *, size_t, void *);  // frees storage of a given size, passed to nthm_set_allocator
+
 typedef struct nthm_pipe_struct *nthm_pipe;   // to be treated as opaque in user application code
 
+typedef struct nthm_runtime_struct *nthm_runtime;   // likewise opaque, created by nthm_runtime_new
+
+struct nthm_config             // passed to nthm_init; zero fields are ignored
+{
+  unsigned long pipes;         // number of pipes to preallocate
+  unsigned long scopes;        // number of scope stacks to preallocate
+  unsigned long pipe_lists;    // number of pipe list nodes to preallocate, typically twice the number of pipes
+  int fast_exit;               // if non-zero, leave threads and storage to be reclaimed by the process terminating
+};
+
+struct nthm_statistics         // filled in by nthm_get_statistics
+{
+  unsigned long waits;         // number of times a read or select had to wait for a result
+  unsigned long polls;         // number of those waits that polled before sleeping
+  unsigned long spun;          // number of waits that polled and ended without sleeping
+};
+
 // translate an error code into a readable message
 extern const char*
 nthm_strerror (int err);
 
+// initialize static storage eagerly and optionally preallocate internal structures
+extern int
+nthm_init (const struct nthm_config *config, int *err);
+
 // start a new thread and return its pipe
 extern nthm_pipe
-nthm_open (nthm_worker operator, void *operand, int *err);
+nthm_open (nthm_worker worker, void *operand, int *err);
+
+// start a new thread on a private copy of the operand and return its pipe
+extern nthm_pipe
+nthm_open_copy (nthm_worker worker, const void *operand, size_t size, int *err);
+
+// start a new thread with a destructor already designated for its result and return its pipe
+extern nthm_pipe
+nthm_open_with_destructor (nthm_worker worker, void *operand, nthm_destructor destructor, int *err);
+
+// start a new thread on a private copy of the operand with a destructor already designated and return its pipe
+extern nthm_pipe
+nthm_open_copy_with_destructor (nthm_worker worker, const void *operand, size_t size, nthm_destructor destructor, int *err);
+
+// designate a function to reclaim the result of a thread if it's discarded without being read
+extern void
+nthm_set_destructor (nthm_pipe source, nthm_destructor destructor, int *err);
 
 // start a new thread with no pipe, but have it automatically reclaimed and synchronized
 extern int
@@ -45,14 +107,54 @@ nthm_blocked (int *err);
 extern nthm_pipe
 nthm_select (int *err);
 
+// like nthm_select but polling up to the given number of times before sleeping
+extern nthm_pipe
+nthm_select_spin (unsigned long polls, int *err);
+
+// store up to max pipes of threads that have finished within the current scope, blocking until there is one
+extern size_t
+nthm_select_many (nthm_pipe *sources, size_t max, int *err);
+
+// wait for all threads in the current scope to finish and read their results and error codes
+extern size_t
+nthm_read_all (void **results, int *statuses, size_t max, int *err);
+
 // poll a specific pipe
 extern int
 nthm_busy (nthm_pipe source, int *err);
 
+// have a function called once when a thread finishes instead of waiting for it
+extern int
+nthm_notify (nthm_pipe source, nthm_notifier notifier, void *context, int *err);
+
+// have a function called once when the next thread within the current scope finishes instead of waiting for it
+extern int
+nthm_notify_select (nthm_notifier notifier, void *context, int *err);
+
 // perform a blocking read from a pipe and then dispose of it
 extern void*
 nthm_read (nthm_pipe source, int *err);
 
+// like nthm_read but polling up to the given number of times before sleeping
+extern void*
+nthm_read_spin (nthm_pipe source, unsigned long polls, int *err);
+
+// read from each of an array of pipes, store their results, and dispose of them
+extern void
+nthm_read_many (nthm_pipe *sources, void **results, size_t n, int *err);
+
+// set the number of times nthm_read and nthm_select poll for a result before sleeping
+extern void
+nthm_set_spin (unsigned long polls, int *err);
+
+// report how often reads and selects had to wait and how often polling sufficed
+extern void
+nthm_get_statistics (struct nthm_statistics *statistics, int *err);
+
+// limit the number of threads running at once in the current runtime, queuing pipes opened beyond it
+extern void
+nthm_set_concurrency (unsigned long threads, int *err);
+
 // tell a thread to shorten its output and finish up
 extern void
 nthm_truncate (nthm_pipe source, int *err);
@@ -93,8 +195,40 @@ nthm_enter_scope (int *err);
 extern void
 nthm_exit_scope (int *err);
 
+// run a function in a new scope and then join or kill any threads it leaves behind
+extern void*
+nthm_scope_run (nthm_worker body, void *operand, int policy, int *err);
+
+// allocate storage that lasts until the current scope is exited, or is handed to the reader of the result
+extern void *
+nthm_scope_alloc (size_t size, int *err);
+
 // wait for all threads created by nthm to exit
 extern void
 nthm_sync (int *err);
 
+// stop creating threads, truncate them, wait for them until a deadline, and then kill the rest
+extern size_t
+nthm_shutdown (const struct timespec *deadline, int *err);
+
+// create a runtime with its own root pool, thread accounting, settings and statistics
+extern nthm_runtime
+nthm_runtime_new (int *err);
+
+// make the current thread create threads in a given runtime, or the default runtime if NULL, returning the previous one
+extern nthm_runtime
+nthm_runtime_select (nthm_runtime runtime, int *err);
+
+// reclaim all threads in a runtime and free it
+extern void
+nthm_runtime_free (nthm_runtime runtime, int *err);
+
+// route all internal allocations through the given functions, or the system allocator if NULL
+extern int
+nthm_set_allocator (nthm_allocator allocate, nthm_deallocator release, void *context, int *err);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,542 @@
+// C++20 layer over nthm with typed pipes, RAII handles and coroutine awaitables
+
+// Everything here is inline and calls only the C API declared in
+// nthm.h, so nothing needs to be linked besides the C library.
+//
+// A pipe<T> is a move-only handle to a thread computing a T. The
+// handle kills the thread when it's destroyed without having been
+// read, or reads and discards the result if its policy is NTHM_JOIN.
+// Workers are any callables returning T, optionally taking an int *
+// for reporting an error code as C workers do. Callables small and
+// trivial enough to fit in the pipe are copied into it by
+// nthm_open_copy, and results no bigger than a pointer are passed in
+// the pointer, so opening and reading such a pipe allocates nothing
+// beyond what the C library does. Other callables and results are
+// moved to the heap, and a result that's discarded is deleted by the
+// pipe's destructor. An exception escaping a worker terminates the
+// program, as it would in a std::thread.
+//
+// A coroutine can co_await a pipe without blocking its thread by
+// awaiting its on member function with a resumer. The pipe is
+// untethered so that it can be read from any thread, and a notifier
+// registered with nthm_notify passes the coroutine to the resumer
+// when the pipe finishes. The resumer runs in the thread that
+// finished, with no pipe identified with it, so it has to hand the
+// coroutine to an event loop or an executor rather than resuming it
+// there. A coroutine resumed in that thread couldn't await or kill
+// the other pipes opened alongside the one it awaited, because they
+// would still be tethered to another thread. Awaiting the next pipe
+// to finish in the current scope works the same way with
+// nthm_notify_select, but needs a resumer that resumes the coroutine
+// in the thread that opened the pipes, because only that thread can
+// select them. The awaiters live in the coroutine frame, so no
+// storage is allocated per await.
+
+#ifndef NTHM_HPP
+#define NTHM_HPP 1
+
+#include "nthm.h"
+#include <cerrno>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace nthm
+{
+  // an error code reported by the C API, thrown from functions that can't return it
+  class error : public std::runtime_error
+  {
+  public:
+	 explicit error (int code) : std::runtime_error (nthm_strerror (code)), value (code) {}
+
+	 // the error code as it would have been assigned to *err
+	 int
+	 code () const noexcept
+	 {
+		return value;
+	 }
+
+  private:
+	 int value;
+  };
+
+
+
+
+
+  // decides where a coroutine resumes after what it awaits is ready
+  struct resumer
+  {
+	 void (*post) (std::coroutine_handle<>, void *) = nullptr;  // required, called in the notifying thread to pass on the coroutine
+	 void *context = nullptr;                                    // passed to post along with the coroutine
+
+	 void
+	 operator() (std::coroutine_handle<> waiting) const
+	 {
+		post (waiting, context);
+	 }
+  };
+
+
+
+
+
+  namespace detail
+  {
+	 // throw an error if the C API reported one
+	 inline void
+	 checked (int err)
+	 {
+		if (err)
+		  throw error (err);
+	 }
+
+
+
+	 // results that are passed in the result pointer itself rather than on the heap
+	 template <class T>
+	 inline constexpr bool unboxed = std::is_void_v<T> || (std::is_trivially_copyable_v<T> && (sizeof (std::conditional_t<std::is_void_v<T>, void *, T>) <= sizeof (void *)));
+
+
+
+	 // workers that are copied into the pipe rather than moved to the heap
+	 template <class F>
+	 inline constexpr bool copied = std::is_trivially_copyable_v<F> && (sizeof (F) <= NTHM_OPERAND_MAX) && (alignof (F) <= alignof (std::max_align_t));
+
+
+
+	 // call a worker with the error code pointer if it takes one
+	 template <class F>
+	 inline decltype (auto)
+	 invoked (F &worker, int *err)
+	 {
+		if constexpr (std::is_invocable_v<F &, int *>)
+		  return worker (err);
+		else
+		  return worker ();
+	 }
+
+
+
+	 // the type of result computed by a worker
+	 template <class F>
+	 using result_t = std::remove_cvref_t<decltype (invoked (std::declval<F &> (), nullptr))>;
+
+
+
+	 // store a result in a form that can be returned through a C worker
+	 template <class T>
+	 inline void *
+	 encoded (T &&value, int *err) noexcept
+	 {
+		void *result;
+
+		if constexpr (unboxed<T>)
+		  {
+			 result = nullptr;
+			 std::memcpy (&result, &value, sizeof (T));
+		  }
+		else if (! (result = new (std::nothrow) T (std::move (value))))
+		  *err = (*err ? *err : ENOMEM);
+		return result;
+	 }
+
+
+
+	 // recover a result stored by encoded
+	 template <class T>
+	 inline T
+	 decoded (void *result)
+	 {
+		if constexpr (std::is_void_v<T>)
+		  return;
+		else if constexpr (unboxed<T>)
+		  {
+			 alignas (T) unsigned char bytes[sizeof (T)];
+
+			 std::memcpy (bytes, &result, sizeof (T));
+			 return *std::launder (static_cast<T *> (static_cast<void *> (bytes)));
+		  }
+		else
+		  {
+			 std::unique_ptr<T> box (static_cast<T *> (result));
+
+			 if (! box)
+				throw error (NTHM_NULPIP);
+			 return std::move (*box);
+		  }
+	 }
+
+
+
+	 // reclaim a result stored by encoded that won't be decoded, passed as the destructor when the pipe is opened
+	 template <class T>
+	 inline void
+	 discarded (void *result)
+	 {
+		if constexpr (! unboxed<T>)
+		  delete static_cast<T *> (result);
+	 }
+
+
+
+	 // the C worker that runs a callable F in the thread, deleting it afterwards unless it was copied into the pipe
+	 template <class F>
+	 void *
+	 worker (void *operand, int *err) noexcept
+	 {
+		using T = result_t<F>;
+		F *f;
+		void *result;
+
+		f = static_cast<F *> (operand);
+		result = nullptr;
+		if constexpr (std::is_void_v<T>)
+		  invoked (*f, err);
+		else
+		  result = encoded<T> (invoked (*f, err), err);
+		if constexpr (! copied<F>)
+		  delete f;
+		return result;
+	 }
+  }
+
+
+
+
+
+  // a move-only handle to a thread computing a result of type T
+  template <class T>
+  class pipe
+  {
+  public:
+	 class awaiter;
+
+	 pipe () noexcept = default;
+
+	 // adopt a pipe opened by nthm::open, possibly returned by nthm_select
+	 explicit pipe (nthm_pipe source, int policy = NTHM_KILL) noexcept : handle (source), disposal (policy) {}
+
+	 pipe (pipe &&other) noexcept : handle (std::exchange (other.handle, nullptr)), disposal (other.disposal) {}
+
+	 pipe &
+	 operator= (pipe &&other) noexcept
+	 {
+		if (this != &other)
+		  {
+			 disposed ();
+			 handle = std::exchange (other.handle, nullptr);
+			 disposal = other.disposal;
+		  }
+		return *this;
+	 }
+
+	 pipe (const pipe &) = delete;
+	 pipe &operator= (const pipe &) = delete;
+
+	 ~pipe ()
+	 {
+		disposed ();
+	 }
+
+	 explicit operator bool () const noexcept
+	 {
+		return handle != nullptr;
+	 }
+
+	 // the underlying pipe, still owned by this handle
+	 nthm_pipe
+	 get () const noexcept
+	 {
+		return handle;
+	 }
+
+	 // give up ownership of the underlying pipe
+	 nthm_pipe
+	 release () noexcept
+	 {
+		return std::exchange (handle, nullptr);
+	 }
+
+	 // read and discard the result on destruction with NTHM_JOIN, or kill the thread with NTHM_KILL
+	 void
+	 set_policy (int policy) noexcept
+	 {
+		disposal = policy;
+	 }
+
+	 // non-zero if reading would block
+	 bool
+	 busy () const
+	 {
+		int err = 0;
+		int b = nthm_busy (handle, &err);
+
+		detail::checked (err);
+		return b != 0;
+	 }
+
+	 // make the thread readable by any thread rather than only its creator
+	 void
+	 untether ()
+	 {
+		int err = 0;
+
+		nthm_untether (handle, &err);
+		detail::checked (err);
+	 }
+
+	 // ask the thread to shorten its output
+	 void
+	 truncate ()
+	 {
+		int err = 0;
+
+		nthm_truncate (handle, &err);
+		detail::checked (err);
+	 }
+
+	 // tell the thread its result won't be read, and let go of it
+	 void
+	 kill ()
+	 {
+		int err = 0;
+
+		nthm_kill (std::exchange (handle, nullptr), &err);
+		detail::checked (err);
+	 }
+
+	 // block until the thread finishes, and then return its result, leaving the handle empty
+	 T
+	 read ()
+	 {
+		int err = 0;
+		void *result;
+
+		if (! handle)
+		  throw error (NTHM_NULPIP);
+		result = nthm_read (std::exchange (handle, nullptr), &err);
+		if (err ? result : nullptr)
+		  detail::discarded<T> (result);
+		detail::checked (err);
+		return detail::decoded<T> (result);
+	 }
+
+	 // await the result, resuming as the resumer decides
+	 awaiter
+	 on (resumer how) noexcept
+	 {
+		return awaiter (*this, how);
+	 }
+
+  private:
+	 // dispose of the thread according to the policy if the handle still owns one
+	 void
+	 disposed () noexcept
+	 {
+		void *result;
+		int err = 0;
+
+		if (! handle)
+		  return;
+		nthm_notify (handle, nullptr, nullptr, &err);
+		if (disposal != NTHM_JOIN)
+		  nthm_kill (handle, &err);
+		else if ((result = nthm_read (handle, &err)))
+		  detail::discarded<T> (result);
+		handle = nullptr;
+	 }
+
+	 nthm_pipe handle = nullptr;  // the owned pipe, if any
+	 int disposal = NTHM_KILL;     // either NTHM_KILL or NTHM_JOIN
+  };
+
+
+
+
+
+  // suspends a coroutine until a pipe finishes, and then reads it
+  template <class T>
+  class pipe<T>::awaiter
+  {
+  public:
+	 awaiter (pipe &source, resumer r) noexcept : owner (source), how (r) {}
+
+	 bool
+	 await_ready () const noexcept
+	 {
+		return false;
+	 }
+
+	 // The coroutine may be resumed on another thread before this
+	 // function returns, so nothing is touched after registering.
+	 bool
+	 await_suspend (std::coroutine_handle<> waiting)
+	 {
+		int err = 0;
+
+		if (! how.post)
+		  throw error (EINVAL);
+		suspended = waiting;
+		nthm_untether (owner.handle, &err);
+		detail::checked (err);
+		if (nthm_notify (owner.handle, &notified, this, &err))
+		  return true;
+		detail::checked (err);
+		return false;
+	 }
+
+	 T
+	 await_resume ()
+	 {
+		return owner.read ();
+	 }
+
+  private:
+	 static void
+	 notified (void *context)
+	 {
+		awaiter *a = static_cast<awaiter *> (context);
+
+		a->how (a->suspended);
+	 }
+
+	 pipe &owner;                         // the pipe being awaited
+	 resumer how;                         // resumes the coroutine
+	 std::coroutine_handle<> suspended;   // the coroutine
+  };
+
+
+
+
+
+  // suspends a coroutine until the next pipe in the current scope finishes, and then selects it
+  template <class T>
+  class finisher
+  {
+  public:
+	 explicit finisher (resumer r) noexcept : how (r) {}
+
+	 bool
+	 await_ready () const noexcept
+	 {
+		return false;
+	 }
+
+	 bool
+	 await_suspend (std::coroutine_handle<> waiting)
+	 {
+		int err = 0;
+
+		if (! how.post)
+		  throw error (EINVAL);
+		suspended = waiting;
+		if (nthm_notify_select (&notified, this, &err))
+		  return true;
+		detail::checked (err);
+		return false;
+	 }
+
+	 // an empty pipe if there are no threads in the scope
+	 pipe<T>
+	 await_resume ()
+	 {
+		int err = 0;
+		nthm_pipe source = nthm_select (&err);
+
+		detail::checked (err);
+		return pipe<T> (source);
+	 }
+
+  private:
+	 static void
+	 notified (void *context)
+	 {
+		finisher *f = static_cast<finisher *> (context);
+
+		f->how (f->suspended);
+	 }
+
+	 resumer how;                         // resumes the coroutine in the thread that opened the pipes
+	 std::coroutine_handle<> suspended;   // the coroutine
+  };
+
+
+
+
+
+  // start a thread running the worker and return its pipe, tethered to the current thread
+  template <class F>
+  pipe<detail::result_t<std::decay_t<F>>>
+  open (F &&worker)
+  {
+	 using G = std::decay_t<F>;
+	 using T = detail::result_t<G>;
+	 nthm_destructor discard = (detail::unboxed<T> ? nullptr : &detail::discarded<T>);
+	 nthm_pipe source;
+	 int err = 0;
+
+	 if constexpr (detail::copied<G>)
+		{
+		  G copy (std::forward<F> (worker));
+
+		  source = nthm_open_copy_with_destructor (&detail::worker<G>, &copy, sizeof (copy), discard, &err);
+		}
+	 else
+		{
+		  G *moved = new G (std::forward<F> (worker));
+
+		  if (! (source = nthm_open_with_destructor (&detail::worker<G>, moved, discard, &err)))
+			 delete moved;
+		}
+	 pipe<T> p (source);
+	 detail::checked (err);
+	 return p;
+  }
+
+
+
+
+
+  // await the next pipe to finish in the current scope, all of whose pipes compute a T
+  template <class T>
+  finisher<T>
+  next (resumer how) noexcept
+  {
+	 return finisher<T> (how);
+  }
+
+
+
+
+
+  // enters a scope on construction and exits it on destruction
+  class scope
+  {
+  public:
+	 scope ()
+	 {
+		int err = 0;
+
+		nthm_enter_scope (&err);
+		detail::checked (err);
+	 }
+
+	 scope (const scope &) = delete;
+	 scope &operator= (const scope &) = delete;
+
+	 ~scope ()
+	 {
+		int err = 0;
+
+		nthm_exit_scope (&err);
+	 }
+  };
+}
+
+#endif
@@ -29,6 +29,8 @@
 #include "pipes.h"
 #include "scopes.h"
 #include "errs.h"
+#include "stock.h"
+#include "runtime.h"
 
 // used to initialize static storage
 static pthread_once_t once_control = PTHREAD_ONCE_INIT;
@@ -42,19 +44,23 @@ static pthread_attr_t thread_attribute;
 // unrecoverable pthread errors are communicated from other threads this way as a last resort
 static int *deadlocked;
 
-// non-zero if initialization is successful
+// non-zero if initialization is successful; read without locking on every API call
 static int initialized = 0;
 
 // an error returned by the initialization routine
 static int initial_error = 0;
 
-// to be done when any user code calls a published API routine
+// non-zero if the exit routine is to skip reclaiming anything, set by nthm_init
+static int fast_exit = 0;
 
-#define API_ENTRY_POINT(x)                                                                  \
-  if (err ? NULL : (err = &ignored_error))                                                   \
-    ignored_error = 0;                                                                        \
-  pthread_once (&once_control, initialization);                                                \
-  if (initialized ? 0 : (*err = (*err ? *err : initial_error ? initial_error : THE_IER(23))))   \
+// to be done when any user code calls a published API routine; pthread_once is consulted only until initialized
+
+#define API_ENTRY_POINT(x)                                                                   \
+  if (err ? NULL : (err = &ignored_error))                                                     \
+    ignored_error = 0;                                                                          \
+  if (! __atomic_load_n (&initialized, __ATOMIC_ACQUIRE))                                       \
+    pthread_once (&once_control, initialization);                                                \
+  if (initialized ? 0 : (*err = (*err ? *err : initial_error ? initial_error : THE_IER(23))))     \
     return x
 
 
@@ -70,14 +76,18 @@ static void
 teardown ()
 
 	  // Free all static storage. This function is installed by
-	  // atexit () in the initialization routine.
+	  // atexit () in the initialization routine. If a fast exit has
+	  // been requested, any threads still running are left to be
+	  // stopped by the process terminating and nothing is freed,
+	  // because the operating system reclaims it all anyway.
 {
-  _nthm_close_pool ();
-  _nthm_close_sync ();      // only one thread runs after this point unless there were unrecoverable pthread errors
-  _nthm_close_context ();
+  if (__atomic_load_n (&fast_exit, __ATOMIC_RELAXED))
+	 return;
+  _nthm_close_runtimes ();  // only one thread runs after this point unless there were unrecoverable pthread errors
   _nthm_close_pipes ();     // check for memory leaks
   _nthm_close_pipl ();
   _nthm_close_scopes ();
+  _nthm_close_stocks ();
   _nthm_globally_throw (pthread_attr_destroy (&thread_attribute) ? THE_IER(24) : 0);
   _nthm_close_errs ();
 }
@@ -95,25 +105,22 @@ initialization ()
   deadlocked = _nthm_deadlocked ();
   if (! _nthm_open_errs (&initial_error))
 	 return;
-  if (! _nthm_open_pipes (&initial_error))
+  if (! _nthm_open_stocks (&initial_error))
 	 goto a;
-  if (! _nthm_open_context (&initial_error))
+  if (! _nthm_open_pipes (&initial_error))
+	 goto g;
+  if (! _nthm_open_runtimes (&initial_error))
 	 goto b;
-  if (! _nthm_open_sync (&initial_error))
-	 goto c;
-  if (! _nthm_open_pool (&initial_error))
-	 goto d;
   if (! _nthm_stack_limited_thread_type (&thread_attribute, &initial_error))
 	 goto e;
   if (atexit (teardown) ? (initial_error = (initial_error ? initial_error : THE_IER(25))) : 0)
 	 goto f;
-  initialized = 1;
+  __atomic_store_n (&initialized, 1, __ATOMIC_RELEASE);
   return;
  f: pthread_attr_destroy (&thread_attribute);
- e: _nthm_close_pool ();
- d: _nthm_close_sync ();
- c: _nthm_close_context ();
+ e: _nthm_close_runtimes ();
  b: _nthm_close_pipes ();
+ g: _nthm_close_stocks ();
  a: _nthm_close_errs ();
 }
 
@@ -132,17 +139,78 @@ initialization ()
 
 
 
-nthm_pipe
-nthm_open (operator, operand, err)
+int
+nthm_set_allocator (allocate, release, context, err)
+	  nthm_allocator allocate;
+	  nthm_deallocator release;
+	  void *context;
+	  int *err;
+
+	  // Allocate all pipes, pipe lists, scope stacks, operand copies
+	  // and runtimes with the given functions, passing them the
+	  // context. This has to be done before anything is allocated,
+	  // including any structures preallocated by nthm_init.
+{
+  API_ENTRY_POINT(0);
+  return _nthm_allocator_set (allocate, release, context, err);
+}
+
+
+
+
+
+
+
+
+int
+nthm_init (config, err)
+	  const struct nthm_config *config;
+	  int *err;
+
+	  // Perform initialization eagerly so that its cost isn't incurred
+	  // by whatever API call happens to be made first, and preallocate
+	  // enough structures to serve a burst of activity without calling
+	  // the system allocator, or request a fast exit. Calling it more
+	  // than once is harmless.
+{
+  API_ENTRY_POINT(0);
+  if (*err ? 1 : ! config)
+	 return ! *err;
+  if (config->fast_exit)
+	 __atomic_store_n (&fast_exit, 1, __ATOMIC_RELAXED);
+  if (! _nthm_stockpiled (PIPE_STOCK, sizeof (struct nthm_pipe_struct), _Alignof (struct nthm_pipe_struct), (uintptr_t) config->pipes, err))
+	 return 0;
+  if (! _nthm_stockpiled (SCOPE_STOCK, SCOPE_ROOM * sizeof (struct scope_stack_struct), _Alignof (struct scope_stack_struct), (uintptr_t) config->scopes, err))
+	 return 0;
+  return _nthm_stockpiled (PIPE_LIST_STOCK, sizeof (struct pipe_list_struct), _Alignof (struct pipe_list_struct), (uintptr_t) config->pipe_lists, err);
+}
+
+
+
+
+
+
+
+
+static nthm_pipe
+opened (operator, operand, original, size, destructor, err)
 	  nthm_worker operator;
 	  void *operand;
+	  const void *original;
+	  size_t size;
+	  nthm_destructor destructor;
 	  int *err;
 
 	  // Return a pipe to a newly created thread tethered to the
-	  // currently running thread.
+	  // currently running thread. The thread runs the operator on the
+	  // operand unless a non-zero size is given, in which case it runs
+	  // the operator on a copy of the original owned by the pipe. If
+	  // the runtime's thread limit is reached, the pipe waits in a
+	  // queue for a thread instead. The destructor, if any, is set
+	  // before the thread starts so that no result can be discarded
+	  // without it.
 {
   nthm_pipe source;
-  thread_spec spec;
   nthm_pipe drain;
   pthread_t c;
   int e;
@@ -155,19 +223,145 @@ nthm_open (operator, operand, err)
 	 return NULL;
   if (*deadlocked ? IER(26) : (!(drain = _nthm_current_or_new_context (err))) ? 1 : (drain->valid != MAGIC) ? IER(27) : 0)
 	 return NULL;
+  if (__atomic_load_n (&(drain->runtime->shut_down), __ATOMIC_ACQUIRE) ? (*err = NTHM_KILLED) : 0)
+	 return NULL;
   if (drain->yielded ? IER(28) : _nthm_heritably_killed_or_yielded (drain, err) ? (*err = (*err ? *err : NTHM_KILLED)) : 0)
 	 return NULL;
-  if (!(spec = _nthm_thread_spec_of (source = _nthm_new_pipe (err), operator, NO_MUTATOR, operand, READ_WRITE, err)))
+  if (!(source = _nthm_copied (_nthm_specified (_nthm_new_pipe (err), drain->runtime, operator, NO_MUTATOR, operand, READ_WRITE, err), original, size, err)))
 	 return NULL;
+  source->destructor = destructor;
   if (! _nthm_tethered (source, drain, err))
 	 goto a;
-  if ((e = pthread_create (&c, &thread_attribute, &_nthm_manager, spec)) ? 0 : _nthm_started (err))
+  e = 0;
+  if (_nthm_queued (source, err) ? 1 : *err ? 0 : (e = pthread_create (&c, &thread_attribute, &_nthm_manager, source)) ? 0 : _nthm_started (drain->runtime, err))
 	 return source;
   *err = (*err ? *err : (e == ENOMEM) ? e : (e == EAGAIN) ? e : THE_IER(29));
+  _nthm_unstarted (source, err);
+  source->yielded = source->killed = 1;       // never started, so retirable as soon as it's untethered
   if (! _nthm_untethered (source, err))
 	 IER(30);
- a: _nthm_unspecify (spec, err);
   return NULL;
+ a: _nthm_retired (source, err);
+  return NULL;
+}
+
+
+
+
+
+
+
+
+nthm_pipe
+nthm_open (operator, operand, err)
+	  nthm_worker operator;
+	  void *operand;
+	  int *err;
+
+	  // Return a pipe to a newly created thread tethered to the
+	  // currently running thread.
+{
+#define NO_COPY NULL
+#define NO_DESTRUCTOR NULL
+
+  return opened (operator, operand, NO_COPY, 0, NO_DESTRUCTOR, err);
+}
+
+
+
+
+
+
+
+
+nthm_pipe
+nthm_open_copy (operator, operand, size, err)
+	  nthm_worker operator;
+	  const void *operand;
+	  size_t size;
+	  int *err;
+
+	  // Return a pipe to a newly created thread tethered to the
+	  // currently running thread, whose operator is passed a copy of
+	  // the operand that remains valid until the operator returns, so
+	  // that the caller may pass the address of a local variable.
+{
+#define NO_OPERAND NULL
+
+  return opened (operator, NO_OPERAND, operand, size, NO_DESTRUCTOR, err);
+}
+
+
+
+
+
+
+
+
+nthm_pipe
+nthm_open_with_destructor (operator, operand, destructor, err)
+	  nthm_worker operator;
+	  void *operand;
+	  nthm_destructor destructor;
+	  int *err;
+
+	  // Return a pipe to a newly created thread tethered to the
+	  // currently running thread, whose result is passed to the
+	  // destructor if it's discarded without being read. Unlike a
+	  // later call to nthm_set_destructor, this leaves no time for the
+	  // result to be discarded before the destructor is set.
+{
+  return opened (operator, operand, NO_COPY, 0, destructor, err);
+}
+
+
+
+
+
+
+
+
+nthm_pipe
+nthm_open_copy_with_destructor (operator, operand, size, destructor, err)
+	  nthm_worker operator;
+	  const void *operand;
+	  size_t size;
+	  nthm_destructor destructor;
+	  int *err;
+
+	  // Combine nthm_open_copy with nthm_open_with_destructor.
+{
+  return opened (operator, NO_OPERAND, operand, size, destructor, err);
+}
+
+
+
+
+
+
+
+
+
+void
+nthm_set_destructor (source, destructor, err)
+	  nthm_pipe source;
+	  nthm_destructor destructor;
+	  int *err;
+
+	  // Designate a function to be applied to the result of a pipe if
+	  // the pipe is retired without its result having been read, as
+	  // when it's killed or still untethered at exit.
+{
+  API_ENTRY_POINT();
+  if (source ? 0 : (*err = (*err ? *err : NTHM_NULPIP)))
+	 return;
+  if ((source->valid != MAGIC) ? (*err = (*err ? *err : NTHM_INVPIP)) : 0)
+	 return;
+  if ((_nthm_lock (&(source->lock)) ? IER(358) : 0) ? (source->valid = MUGGLE(105)) : 0)
+	 return;
+  source->destructor = destructor;
+  if (_nthm_unlock (&(source->lock)) ? IER(359) : 0)
+	 source->valid = MUGGLE(106);
 }
 
 
@@ -187,7 +381,8 @@ nthm_send (mutator, operand, err)
 	  // be reclaimed automatically when it yields, and will
 	  // synchronize with the main application thread at exit.
 {
-  thread_spec spec;
+  nthm_runtime r;
+  nthm_pipe source;
   nthm_pipe d;
   pthread_t c;
   int e;
@@ -200,14 +395,18 @@ nthm_send (mutator, operand, err)
 	 return 0;
   if ((!(d = _nthm_current_context ())) ? 0 : (d->valid != MAGIC) ? IER(32) : d->yielded ? IER(33) : 0)
 	 return 0;
+  if (__atomic_load_n (&((r = (d ? d->runtime : _nthm_selected_runtime ()))->shut_down), __ATOMIC_ACQUIRE) ? (*err = NTHM_KILLED) : 0)
+	 return 0;
   if ((! d) ? 0 : _nthm_heritably_killed_or_yielded (d, err) ? (*err = (*err ? *err : NTHM_KILLED)) : 0)
 	 return 0;
-  if (!(spec = _nthm_thread_spec_of (_nthm_new_pipe (err), NO_OPERATOR, mutator, operand, WRITE_ONLY, err)))
+  if (!(source = _nthm_specified (_nthm_new_pipe (err), r, NO_OPERATOR, mutator, operand, WRITE_ONLY, err)))
 	 return 0;
-  if ((e = pthread_create (&c, &thread_attribute, &_nthm_manager, spec)) ? 0 : _nthm_started (err))
+  e = 0;
+  if (_nthm_queued (source, err) ? 1 : *err ? 0 : (e = pthread_create (&c, &thread_attribute, &_nthm_manager, source)) ? 0 : _nthm_started (r, err))
 	 return 1;
   *err = (*err ? *err : (e == ENOMEM) ? e : (e == EAGAIN) ? e : THE_IER(34));
-  _nthm_unspecify (spec, err);
+  _nthm_unstarted (source, err);
+  _nthm_retired (source, err);
   return 0;
 }
 
@@ -219,25 +418,31 @@ nthm_send (mutator, operand, err)
 
 
 
-void *
-nthm_read (source, err)
+static void *
+drained (source, polls, err)
 	  nthm_pipe source;
+	  unsigned long polls;
 	  int *err;
 
-	  // Perform a blocking read on a pipe and retire it after reading,
-	  // provided the pipe is not tethered to any other thread.
+	  // Perform a blocking read on a pipe, polling up to the given
+	  // number of times before sleeping, and retire it after reading,
+	  // provided the pipe is not tethered to any other thread. A pipe
+	  // that has already finished is read without being tethered.
 {
   nthm_pipe drain;
+  void *result;
+  int done;
 
-  API_ENTRY_POINT(NULL);
   if (*deadlocked ? IER(35) : source ? 0 : (*err = (*err ? *err : NTHM_NULPIP)))
 	 return NULL;
   if ((source->valid == MAGIC) ? 0 : (*err = (*err ? *err : NTHM_INVPIP)))
 	 return NULL;
   if (! (drain = _nthm_current_context ()))
-	 return _nthm_untethered_read (source, err);
+	 return _nthm_untethered_read (source, polls, err);
+  if ((result = _nthm_finished_read (source, &done, err)) ? 1 : done)
+	 return result;
   if (_nthm_tethered (source, drain, err))
-	 return _nthm_tethered_read (source, err);
+	 return _nthm_tethered_read (source, polls, err);
   return NULL;
 }
 
@@ -248,6 +453,77 @@ nthm_read (source, err)
 
 
 
+void *
+nthm_read (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Perform a blocking read on a pipe and retire it after reading,
+	  // provided the pipe is not tethered to any other thread.
+{
+  API_ENTRY_POINT(NULL);
+  return drained (source, __atomic_load_n (&(_nthm_current_runtime ()->spin), __ATOMIC_RELAXED), err);
+}
+
+
+
+
+
+
+
+
+void *
+nthm_read_spin (source, polls, err)
+	  nthm_pipe source;
+	  unsigned long polls;
+	  int *err;
+
+	  // Perform a blocking read on a pipe, polling up to the given
+	  // number of times before sleeping regardless of the global
+	  // setting.
+{
+  API_ENTRY_POINT(NULL);
+  return drained (source, polls, err);
+}
+
+
+
+
+
+
+
+
+
+void
+nthm_read_many (sources, results, n, err)
+	  nthm_pipe *sources;
+	  void **results;
+	  size_t n;
+	  int *err;
+
+	  // Read and retire each of n pipes, storing their results in the
+	  // corresponding entries of the results array. Every pipe is read
+	  // even after an error so that none is left unretired, and the
+	  // first error is reported. Reading no pipes does nothing.
+{
+  unsigned long polls;
+  size_t i;
+
+  API_ENTRY_POINT();
+  if ((n ? (sources ? (! results) : 1) : 0) ? (*err = (*err ? *err : EINVAL)) : ! n)
+	 return;
+  polls = __atomic_load_n (&(_nthm_current_runtime ()->spin), __ATOMIC_RELAXED);
+  for (i = 0; i < n; i++)
+	 results[i] = drained (sources[i], polls, err);
+}
+
+
+
+
+
+
+
+
 int
 nthm_busy (source, err)
 	  nthm_pipe source;
@@ -262,10 +538,48 @@ nthm_busy (source, err)
 	 return 0;
   if ((source->valid == MAGIC) ? 0 : (*err = (*err ? *err : NTHM_INVPIP)))
 	 return 0;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(36) : 0) ? (source->valid = MUGGLE(1)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(36) : 0) ? (source->valid = MUGGLE(1)) : 0)
 	 return 0;
   busy = ! source->yielded;
-  return ((pthread_mutex_unlock (&(source->lock)) ? IER(37) : 0) ? (!(source->valid = MUGGLE(2))) : busy);
+  return ((_nthm_unlock (&(source->lock)) ? IER(37) : 0) ? (!(source->valid = MUGGLE(2))) : busy);
+}
+
+
+
+
+
+
+
+
+
+int
+nthm_notify (source, notifier, context, err)
+	  nthm_pipe source;
+	  nthm_notifier notifier;
+	  void *context;
+	  int *err;
+
+	  // Arrange for the notifier to be called on the context once when
+	  // the source yields, replacing any previous arrangement, and
+	  // return non-zero, or return zero if the source has already
+	  // yielded or been killed. A NULL notifier cancels the
+	  // arrangement.
+{
+  int n;
+
+  API_ENTRY_POINT(0);
+  if (source ? 0 : (*err = (*err ? *err : NTHM_NULPIP)))
+	 return 0;
+  if ((source->valid == MAGIC) ? 0 : (*err = (*err ? *err : NTHM_INVPIP)))
+	 return 0;
+  if ((_nthm_lock (&(source->lock)) ? IER(516) : 0) ? (source->valid = MUGGLE(160)) : 0)
+	 return 0;
+  if ((n = (source->yielded ? 0 : ! source->killed)))
+	 {
+		source->notifier = notifier;
+		source->notice = context;
+	 }
+  return ((_nthm_unlock (&(source->lock)) ? IER(517) : 0) ? (!(source->valid = MUGGLE(161))) : n);
 }
 
 
@@ -289,11 +603,11 @@ nthm_blocked (err)
   API_ENTRY_POINT(0);
   if ((!(drain = _nthm_current_context ())) ? 1 : (drain->valid != MAGIC) ? IER(38) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(drain->lock)) ? IER(39) : 0) ? (drain->valid = MUGGLE(3)) : (blocked = 0))
+  if ((_nthm_lock (&(drain->lock)) ? IER(39) : 0) ? (drain->valid = MUGGLE(3)) : (blocked = 0))
 	 return 0;
-  if (!(((e = drain->scope) ? 0 : IER(40)) ? (drain->valid = MUGGLE(4)) : 0))
+  if (!(((e = drain->scope) ? 0 : IER(40)) ? (drain->valid = MUGGLE(4)) : ! _nthm_collected (drain, err)))
 	 blocked = (e->finishers ? 0 : ! ! (e->blockers));
-  return (((pthread_mutex_unlock (&(drain->lock)) ? IER(41) : 0) ? (drain->valid = MUGGLE(5)) : 0) ? 0 : blocked);
+  return (((_nthm_unlock (&(drain->lock)) ? IER(41) : 0) ? (drain->valid = MUGGLE(5)) : 0) ? 0 : blocked);
 }
 
 
@@ -303,31 +617,77 @@ nthm_blocked (err)
 
 
 
-nthm_pipe
-nthm_select (err)
+
+int
+nthm_notify_select (notifier, context, err)
+	  nthm_notifier notifier;
+	  void *context;
+	  int *err;
+
+	  // Arrange for the notifier to be called on the context once when
+	  // the next source in the current scope yields and return
+	  // non-zero, or return zero if nthm_select wouldn't block. The
+	  // herald is published before the arrivals are checked one last
+	  // time, so either the drain sees a source that has arrived in
+	  // the meantime and collects it, or the source sees the herald
+	  // and waits for the lock to take it. A NULL notifier cancels the
+	  // arrangement.
+{
+  nthm_pipe drain;
+  scope_stack e;
+  int n;
+
+  API_ENTRY_POINT(0);
+  if ((!(drain = _nthm_current_context ())) ? 1 : (drain->valid != MAGIC) ? IER(518) : 0)
+	 return 0;
+  if ((_nthm_lock (&(drain->lock)) ? IER(519) : 0) ? (drain->valid = MUGGLE(162)) : (n = 0))
+	 return 0;
+  if (((e = drain->scope) ? 0 : IER(520)) ? (drain->valid = MUGGLE(163)) : 0)
+	 goto a;
+  for (; n ? 0 : (! _nthm_collected (drain, err)) ? 0 : e->finishers ? 0 : _nthm_killed_or_cancelled (drain, err) ? 0 : ! ! (e->blockers); n = ! __atomic_load_n (&(drain->arrivals), __ATOMIC_SEQ_CST))
+	 {
+		drain->heralded = context;
+		drain->herald_depth = drain->level;
+		__atomic_store_n (&(drain->herald), notifier, __ATOMIC_SEQ_CST);
+	 }
+  if (! n)
+	 __atomic_store_n (&(drain->herald), NULL, __ATOMIC_RELAXED);
+ a: return (((_nthm_unlock (&(drain->lock)) ? IER(521) : 0) ? (drain->valid = MUGGLE(164)) : 0) ? 0 : n);
+}
+
+
+
+
+
+
+
+
+static nthm_pipe
+selected (polls, err)
+	  unsigned long polls;
 	  int *err;
 
 	  // Return the next readable pipe tethered to the currently
 	  // running thread if any, blocking if necessary until a readable
 	  // pipe is available, but with blocking interrupted if the
-	  // currently running thread is killed.
+	  // currently running thread is killed. Poll up to the given
+	  // number of times before each wait.
 {
   nthm_pipe s, d;
   scope_stack e;
   int k;
 
-  API_ENTRY_POINT(NULL);
   s = NULL;
   if (*deadlocked ? IER(42) : (!(d = _nthm_current_context ())) ? 1 : (d->valid == MAGIC) ? 0 : IER(43))
 	 goto a;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(44) : 0) ? (d->valid = MUGGLE(6)) : (k = 0))
+  if ((_nthm_lock (&(d->lock)) ? IER(44) : 0) ? (d->valid = MUGGLE(6)) : (k = 0))
 	 goto a;
   if (((e = d->scope) ? 0 : IER(45)) ? (d->valid = MUGGLE(7)) : 0)
 	 goto b;
-  for (; (k = d->killed) ? 0 : (s = _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err)) ? 0 : ! ! (e->blockers);)
-	 if ((pthread_cond_wait (&(d->progress), &(d->lock)) ? IER(46) : 0) ? (d->valid = MUGGLE(8)) : 0)
+  for (; (k = _nthm_killed_or_cancelled (d, err)) ? 0 : (! _nthm_collected (d, err)) ? 0 : (s = _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err)) ? 0 : ! ! (e->blockers);)
+	 if (! _nthm_awaited (d, polls, err))
 		break;
- b: if ((pthread_mutex_unlock (&(d->lock)) ? IER(47) : 0) ? (d->valid = MUGGLE(9)) : 0)
+ b: if ((_nthm_unlock (&(d->lock)) ? IER(47) : 0) ? (d->valid = MUGGLE(9)) : 0)
 	 goto a;
   *err = (*err ? *err : k ? NTHM_KILLED : 0);
  a: return s;
@@ -340,6 +700,148 @@ nthm_select (err)
 
 
 
+nthm_pipe
+nthm_select (err)
+	  int *err;
+
+	  // Return the next readable pipe tethered to the currently
+	  // running thread if any, blocking if necessary.
+{
+  API_ENTRY_POINT(NULL);
+  return selected (__atomic_load_n (&(_nthm_current_runtime ()->spin), __ATOMIC_RELAXED), err);
+}
+
+
+
+
+
+
+
+
+nthm_pipe
+nthm_select_spin (polls, err)
+	  unsigned long polls;
+	  int *err;
+
+	  // Return the next readable pipe tethered to the currently
+	  // running thread if any, polling up to the given number of
+	  // times before sleeping regardless of the global setting.
+{
+  API_ENTRY_POINT(NULL);
+  return selected (polls, err);
+}
+
+
+
+
+
+
+
+
+
+size_t
+nthm_select_many (sources, max, err)
+	  nthm_pipe *sources;
+	  size_t max;
+	  int *err;
+
+	  // Store up to max readable pipes tethered to the currently
+	  // running thread in the sources array and return the number
+	  // stored, blocking as nthm_select does until at least one is
+	  // available, but taking all of them that are available at that
+	  // point under a single acquisition of the lock.
+{
+  nthm_pipe d;
+  scope_stack e;
+  size_t n;
+  int k;
+
+  API_ENTRY_POINT(0);
+  n = 0;
+  if ((max ? (! sources) : 0) ? (*err = (*err ? *err : EINVAL)) : ! max)
+	 goto a;
+  if (*deadlocked ? IER(379) : (!(d = _nthm_current_context ())) ? 1 : (d->valid == MAGIC) ? 0 : IER(380))
+	 goto a;
+  if ((_nthm_lock (&(d->lock)) ? IER(381) : 0) ? (d->valid = MUGGLE(117)) : (k = 0))
+	 goto a;
+  if (((e = d->scope) ? 0 : IER(382)) ? (d->valid = MUGGLE(118)) : 0)
+	 goto b;
+  for (; (k = _nthm_killed_or_cancelled (d, err)) ? 0 : (! _nthm_collected (d, err)) ? 0 : e->finishers ? 0 : ! ! (e->blockers);)
+	 if (! _nthm_awaited (d, __atomic_load_n (&(d->runtime->spin), __ATOMIC_RELAXED), err))
+		break;
+  while (k ? 0 : (n < max) ? ! ! (sources[n] = _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err)) : 0)
+	 n++;
+ b: if ((_nthm_unlock (&(d->lock)) ? IER(383) : 0) ? (d->valid = MUGGLE(119)) : 0)
+	 goto a;
+  *err = (*err ? *err : k ? NTHM_KILLED : 0);
+ a: return n;
+}
+
+
+
+
+
+
+
+
+
+size_t
+nthm_read_all (results, statuses, max, err)
+	  void **results;
+	  int *statuses;
+	  size_t max;
+	  int *err;
+
+	  // Wait for every thread in the current scope to finish, and then
+	  // read and retire up to max of them in the order they finished,
+	  // storing their results and, if statuses is non-NULL, their
+	  // error codes, and return the number read. The caller is woken
+	  // only when the last of them finishes. The pipes are held in the
+	  // results array while the drain is locked and replaced by their
+	  // results after it's unlocked, because reading them needs the
+	  // lock.
+{
+  nthm_pipe d;
+  scope_stack e;
+  size_t i, n;
+  int done, status, k;
+
+  API_ENTRY_POINT(0);
+  n = 0;
+  if ((max ? (! results) : 0) ? (*err = (*err ? *err : EINVAL)) : ! max)
+	 goto a;
+  if (*deadlocked ? IER(540) : (!(d = _nthm_current_context ())) ? 1 : (d->valid == MAGIC) ? 0 : IER(384))
+	 goto a;
+  if ((_nthm_lock (&(d->lock)) ? IER(385) : 0) ? (d->valid = MUGGLE(173)) : (k = 0))
+	 goto a;
+  if ((((e = d->scope) ? 0 : IER(386)) ? (d->valid = MUGGLE(120)) : ! _nthm_joined (d, err)) ? 1 : (k = _nthm_killed_or_cancelled (d, err)))
+	 goto b;
+  while ((n < max) ? ! ! (results[n] = (void *) _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err)) : 0)
+	 n++;
+ b: if ((_nthm_unlock (&(d->lock)) ? IER(387) : 0) ? (d->valid = MUGGLE(121)) : 0)
+	 goto a;
+  *err = (*err ? *err : k ? NTHM_KILLED : 0);
+  for (i = 0; i < n; i++)
+	 {
+		status = 0;
+		results[i] = _nthm_finished_read ((nthm_pipe) results[i], &done, &status);
+		if (done ? 0 : ! status)
+		  status = THE_IER(388);
+		if (statuses)
+		  statuses[i] = status;
+		else if (*err ? 0 : status)
+		  *err = status;
+	 }
+ a: return n;
+}
+
+
+
+
+
+
+
+
 void
 nthm_truncate (source, err)
 	  nthm_pipe source;
@@ -357,12 +859,12 @@ nthm_truncate (source, err)
 	 return;
   if (_nthm_drained_by (source, drain, err) ? 0 : (*err = (*err ? *err : NTHM_NOTDRN)))
 	 return;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(48) : 0) ? (source->valid = MUGGLE(10)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(48) : 0) ? (source->valid = MUGGLE(10)) : 0)
 	 return;
   if (!((source->scope ? 0 : IER(49)) ? (source->valid = MUGGLE(11)) : 0))
 	 if ((bumped = source->scope->truncation + 1))
 		source->scope->truncation = bumped;
-  if (pthread_mutex_unlock (&(source->lock)) ? IER(50) : 0)
+  if (_nthm_unlock (&(source->lock)) ? IER(50) : 0)
 	 source->valid = MUGGLE(12);
 }
 
@@ -386,12 +888,12 @@ nthm_truncate_all (err)
   API_ENTRY_POINT();
   if ((!(drain = _nthm_current_context ())) ? 1 : (drain->valid != MAGIC) ? IER(51) : 0)
 	 return;
-  if ((pthread_mutex_lock (&(drain->lock)) ? IER(52) : 0) ? (drain->valid = MUGGLE(13)) : 0)
+  if ((_nthm_lock (&(drain->lock)) ? IER(52) : 0) ? (drain->valid = MUGGLE(13)) : 0)
 	 return;
   if (!((drain->scope ? 0 : IER(53)) ? (drain->valid = MUGGLE(14)) : 0))
 	 if ((bumped = drain->scope->truncation + 1))
 		drain->scope->truncation = bumped;
-  if (pthread_mutex_unlock (&(drain->lock)) ? IER(54) : 0)
+  if (_nthm_unlock (&(drain->lock)) ? IER(54) : 0)
 	 drain->valid = MUGGLE(15);
 }
 
@@ -419,12 +921,12 @@ nthm_truncated (err)
 	 return 0;
   if ((source->valid != MAGIC) ? IER(55) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(56) : 0) ? (source->valid = MUGGLE(16)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(56) : 0) ? (source->valid = MUGGLE(16)) : 0)
 	 return 0;
   if ((source->scope ? 0 : IER(57)) ? (source->valid = MUGGLE(17)) : 0)
-	 return ((pthread_mutex_unlock (&(source->lock)) ? IER(58) : 0) ? ((unsigned) ! (source->valid = MUGGLE(18))) : 0);
+	 return ((_nthm_unlock (&(source->lock)) ? IER(58) : 0) ? ((unsigned) ! (source->valid = MUGGLE(18))) : 0);
   t = source->scope->truncation;
-  if ((pthread_mutex_unlock (&(source->lock)) ? IER(59) : 0) ? (source->valid = MUGGLE(19)) : 0)
+  if ((_nthm_unlock (&(source->lock)) ? IER(59) : 0) ? (source->valid = MUGGLE(19)) : 0)
 	 return 0;
   return (t ? t : _nthm_heritably_truncated (source, err));
 }
@@ -461,18 +963,17 @@ void
 nthm_kill_all (err)
 	  int *err;
 
-	  // Tell all pipes tethered to the current one to pack it in. The
-	  // placeholder field has to be cleared temporarily to stop the
-	  // pipe from being reclaimed prematurely.
+	  // Tell all pipes tethered to the current one in the current
+	  // scope to pack it in. They're cancelled together rather than
+	  // being killed one at a time, and retired by the drain later
+	  // when they're collected.
 {
   nthm_pipe drain;
 
   API_ENTRY_POINT();
   if (!(drain = _nthm_current_context ()))
 	 return;
-  if (drain->placeholder ? (drain->placeholder = 0) : _nthm_descendants_killed (drain, err) ? 1 : IER(61))
-	 return;
-  if (_nthm_descendants_killed (drain, err) ? (drain->placeholder = 1) : ! IER(62))
+  if (_nthm_descendants_cancelled (drain, err) ? 1 : ! IER(61))
 	 _nthm_unpool (drain, err);
 }
 
@@ -499,10 +1000,10 @@ nthm_killed (err)
 	 return 0;
   if ((source->valid != MAGIC) ? IER(63) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(64) : 0) ? (source->valid = MUGGLE(20)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(64) : 0) ? (source->valid = MUGGLE(20)) : 0)
 	 return 0;
-  dead = source->killed;
-  return (((pthread_mutex_unlock (&(source->lock)) ? IER(65) : 0) ? (source->valid = MUGGLE(21)) : 0) ? 1 : dead);
+  dead = (source->killed ? 1 : _nthm_cancelled (source, err));
+  return (((_nthm_unlock (&(source->lock)) ? IER(65) : 0) ? (source->valid = MUGGLE(21)) : 0) ? 1 : dead);
 }
 
 
@@ -553,7 +1054,7 @@ nthm_tether (source, err)
 	 return;
   if ((source->valid != MAGIC) ? (*err = (*err ? *err : NTHM_INVPIP)) : !(drain = _nthm_current_or_new_context (err)))
 	 return;
-  if ((drain->valid != MAGIC) ? IER(67) : drain->yielded ? IER(68) : 0)
+  if ((drain->valid != MAGIC) ? IER(67) : drain->yielded ? IER(68) : (source->runtime != drain->runtime) ? (*err = (*err ? *err : EINVAL)) : 0)
 	 return;
   if (_nthm_heritably_killed_or_yielded (drain, err))
 	 *err = (*err ? *err : NTHM_KILLED);
@@ -608,7 +1109,7 @@ nthm_exit_scope (err)
 	 return;
   if (((e = p->scope) ? 0 : IER(73)) ? (p->valid = MUGGLE(22)) : 0)
 	 return;
-  if ((!(e->enclosure)) ? (*err = (*err ? *err : NTHM_UNDFLO)) : ! _nthm_descendants_untethered (p, err))
+  if ((!(p->level)) ? (*err = (*err ? *err : NTHM_UNDFLO)) : ! _nthm_descendants_untethered (p, err))
 	 return;
   if (_nthm_scope_exited (p, err))
 	 _nthm_unpool (p, err);
@@ -621,12 +1122,284 @@ nthm_exit_scope (err)
 
 
 
+
+void *
+nthm_scope_run (body, operand, policy, err)
+	  nthm_worker body;
+	  void *operand;
+	  int policy;
+	  int *err;
+
+	  // Run the body in a new scope and return its result. Threads
+	  // it leaves in the scope are then either waited for and retired
+	  // or killed according to the policy, so that the scope can be
+	  // exited without untethering any of them, and their unread
+	  // results are passed to their destructors. Threads are killed
+	  // regardless of the policy if the caller is killed. If the body
+	  // leaves scopes of its own unexited, they're exited as they
+	  // would be by nthm_exit_scope.
+{
+  nthm_pipe p;
+  uintptr_t level;
+  void *result;
+
+  API_ENTRY_POINT(NULL);
+  if (((! body) ? 1 : (policy == NTHM_JOIN) ? 0 : (policy != NTHM_KILL)) ? (*err = (*err ? *err : EINVAL)) : 0)
+	 return NULL;
+  if (*deadlocked ? IER(389) : (!(p = _nthm_current_or_new_context (err))) ? 1 : (p->valid != MAGIC) ? IER(390) : 0)
+	 return NULL;
+  if (p->yielded ? IER(391) : _nthm_heritably_killed_or_yielded (p, err) ? (*err = (*err ? *err : NTHM_KILLED)) : ! _nthm_scope_entered (p, err))
+	 return NULL;
+  level = p->level;
+  result = (body) (operand, err);
+  if ((_nthm_current_context () == p) ? 0 : IER(392))
+	 return result;
+  while ((p->level > level) ? (*err = (*err ? *err : NTHM_XSCOPE)) : 0)
+	 if (!(_nthm_descendants_untethered (p, err) ? _nthm_scope_exited (p, err) : 0))
+		return result;
+  if ((p->level == level) ? 0 : (*err = (*err ? *err : NTHM_UNDFLO)))
+	 return result;
+  if (policy == NTHM_KILL)
+	 goto a;
+  if ((_nthm_lock (&(p->lock)) ? IER(393) : 0) ? (p->valid = MUGGLE(122)) : 0)
+	 return result;
+  _nthm_joined (p, err);
+  if ((_nthm_unlock (&(p->lock)) ? IER(394) : 0) ? (p->valid = MUGGLE(123)) : 0)
+	 return result;
+ a: if (_nthm_descendants_killed (p, 1, err) ? _nthm_descendants_untethered (p, err) ? _nthm_scope_exited (p, err) : 0 : 0)
+	 _nthm_unpool (p, err);
+  return result;
+}
+
+
+
+
+
+
+
+
+void *
+nthm_scope_alloc (size, err)
+	  size_t size;
+	  int *err;
+
+	  // Allocate storage from an arena belonging to the current scope,
+	  // which is freed all at once when the scope is exited. Storage
+	  // allocated by a thread at its top level stays with its pipe and
+	  // passes to the current scope of the thread that reads its
+	  // result.
+{
+  nthm_pipe p;
+
+  API_ENTRY_POINT(NULL);
+  if (*deadlocked ? IER(471) : (! size) ? 1 : (!(p = _nthm_current_or_new_context (err))) ? 1 : (p->valid != MAGIC) ? IER(472) : 0)
+	 return NULL;
+  if (p->yielded ? IER(473) : 0)
+	 return NULL;
+  return _nthm_scope_allocation (p, size, err);
+}
+
+
+
+
+
+
+
+
 void
 nthm_sync (err)
 	  int *err;
 
-	  // Wait for all threads created by nthm to exit.
+	  // Wait for all threads created by nthm in the current runtime to
+	  // exit, and then retire any cancelled ones tethered to the
+	  // current thread.
+{
+  nthm_pipe drain;
+
+  API_ENTRY_POINT();
+  _nthm_synchronize (_nthm_current_runtime (), err);
+  if ((drain = _nthm_current_context ()) ? _nthm_fallen_retired (drain, err) : 0)
+	 _nthm_unpool (drain, err);
+}
+
+
+
+
+
+
+
+
+size_t
+nthm_shutdown (deadline, err)
+	  const struct timespec *deadline;
+	  int *err;
+
+	  // Refuse to create any more threads, truncate all of them, wait
+	  // until either they've all finished or the deadline passes, and
+	  // then kill any that are still running, returning their number.
+	  // A thread created by nthm calling this function is one of those
+	  // truncated and killed, but isn't counted or waited for.
+{
+  nthm_runtime r;
+  nthm_pipe context;
+  uintptr_t floor, n;
+
+  API_ENTRY_POINT(0);
+  if ((! deadline) ? 0 : (deadline->tv_nsec < 0) ? 1 : (deadline->tv_nsec >= 1000000000L))
+	 {
+		*err = (*err ? *err : EINVAL);
+		return 0;
+	 }
+  __atomic_store_n (&((r = _nthm_current_runtime ())->shut_down), 1, __ATOMIC_RELEASE);
+  floor = ((context = _nthm_current_context ()) ? (uintptr_t) ! (context->placeholder) : 0);
+  if (! _nthm_pool_truncated (r, err))
+	 return 0;
+  if ((n = _nthm_runners_awaited (r, floor, deadline, err)) > floor ? ! _nthm_pool_killed (r, err) : 0)
+	 return 0;
+  return (size_t) ((n > floor) ? (n - floor) : 0);
+}
+
+
+
+
+
+
+
+
+void
+nthm_set_spin (polls, err)
+	  unsigned long polls;
+	  int *err;
+
+	  // Set the number of times nthm_read and nthm_select poll for a
+	  // result before sleeping in the current runtime. Polling is
+	  // worthwhile when results take less time to compute than a
+	  // thread takes to sleep and wake up.
+{
+  API_ENTRY_POINT();
+  __atomic_store_n (&(_nthm_current_runtime ()->spin), polls, __ATOMIC_RELAXED);
+}
+
+
+
+
+
+
+
+
+void
+nthm_set_concurrency (threads, err)
+	  unsigned long threads;
+	  int *err;
+
+	  // Limit the number of threads that run at once in the current
+	  // runtime, or remove the limit if zero. Pipes opened beyond the
+	  // limit wait in a queue until a thread finishes and takes them
+	  // up, or until they're read, in which case the reader runs them.
+	  // Threads created before a limit is set aren't counted against
+	  // it.
+{
+  nthm_runtime r;
+
+  API_ENTRY_POINT();
+  if (pthread_mutex_lock (&((r = _nthm_current_runtime ())->queue_lock)) ? IER(514) : 0)
+	 return;
+  __atomic_store_n (&(r->limit), threads, __ATOMIC_RELAXED);
+  if (pthread_mutex_unlock (&(r->queue_lock)))
+	 IER(515);
+}
+
+
+
+
+
+
+
+
+void
+nthm_get_statistics (statistics, err)
+	  struct nthm_statistics *statistics;
+	  int *err;
+
+	  // Report how often reads and selects in the current runtime
+	  // have had to wait for a result and how often polling has spared
+	  // them from sleeping.
 {
   API_ENTRY_POINT();
-  _nthm_synchronize (err);
+  if (statistics ? 0 : (*err = (*err ? *err : EINVAL)))
+	 return;
+  _nthm_wait_counts (&(_nthm_current_runtime ()->tally), statistics);
+}
+
+
+
+
+
+
+
+
+nthm_runtime
+nthm_runtime_new (err)
+	  int *err;
+
+	  // Return a new runtime with its own root pool, thread
+	  // accounting, settings and statistics.
+{
+  API_ENTRY_POINT(NULL);
+  if (*deadlocked ? IER(463) : 0)
+	 return NULL;
+  return _nthm_new_runtime (err);
+}
+
+
+
+
+
+
+
+
+nthm_runtime
+nthm_runtime_select (runtime, err)
+	  nthm_runtime runtime;
+	  int *err;
+
+	  // Make the current thread create threads in the given runtime,
+	  // or in the default runtime if it's NULL, and return the
+	  // previously selected one. Only a thread that has no pipe of its
+	  // own at the moment can select a runtime.
+{
+  API_ENTRY_POINT(NULL);
+  if ((! runtime) ? 0 : (runtime->valid != MAGIC) ? (*err = (*err ? *err : EINVAL)) : 0)
+	 return NULL;
+  if (_nthm_current_context () ? (*err = (*err ? *err : EBUSY)) : 0)
+	 return NULL;
+  return _nthm_select_runtime (runtime);
+}
+
+
+
+
+
+
+
+
+void
+nthm_runtime_free (runtime, err)
+	  nthm_runtime runtime;
+	  int *err;
+
+	  // Kill and reclaim all threads in a runtime other than the
+	  // default, wait for them to exit, and free the runtime. The
+	  // current thread can't be one of them.
+{
+  nthm_pipe context;
+
+  API_ENTRY_POINT();
+  if (((! runtime) ? 1 : (runtime->valid != MAGIC) ? 1 : (runtime == _nthm_default_runtime ())) ? (*err = (*err ? *err : EINVAL)) : 0)
+	 return;
+  if (((context = _nthm_current_context ()) ? (context->placeholder ? 0 : (context->runtime == runtime)) : 0) ? (*err = (*err ? *err : EBUSY)) : 0)
+	 return;
+  if (_nthm_selected_runtime () == runtime)
+	 _nthm_select_runtime (NULL);
+  _nthm_runtime_closed (runtime, err);
 }
@@ -19,47 +19,19 @@
 
 #include <stddef.h>
 #include <stdlib.h>
-#include <errno.h>
 #include <stdint.h>
 #include <pthread.h>
 #include "context.h"
 #include "pipes.h"
 #include "pool.h"
+#include "runtime.h"
 #include "errs.h"
 
-// used to retrieve the pipe writable by the currently executing thread
-static pthread_key_t cursor;
-
-
-
-
-// --------------- initialization and teardown -------------------------------------------------------------
-
-
-
-
-int
-_nthm_open_context (err)
-	  int *err;
-
-	  // Create the thread specific storage key.
-{
-  return ! (pthread_key_create (&cursor, NULL) ? IER(74) : 0);
-}
-
-
-
-
-
-
-void
-_nthm_close_context ()
-
-	  // Free the thread specific storage key.
-{
-  _nthm_globally_throw (pthread_key_delete (cursor) ? THE_IER(75) : 0);
-}
+// the pipe writable by the currently executing thread, if any, in a form that's cheap to retrieve
+static _Thread_local nthm_pipe cursor __attribute__ ((tls_model ("initial-exec"))) = NULL;
 
+// the runtime selected by the currently executing thread for creating its placeholder, if not the default
+static _Thread_local nthm_runtime selection __attribute__ ((tls_model ("initial-exec"))) = NULL;
 
 
 
@@ -76,7 +48,7 @@ _nthm_current_context ()
 	  // Return a pointer to the pipe node corresponding to the
 	  // currently running thread, if any.
 {
-  return (nthm_pipe) pthread_getspecific (cursor);
+  return cursor;
 }
 
 
@@ -90,14 +62,12 @@ _nthm_set_context (drain, err)
 	  nthm_pipe drain;
 	  int *err;
 
-	  // Identify a pipe with the current thread context.
+	  // Identify a pipe with the current thread context. Thread local
+	  // storage is allocated when the thread is created, so this
+	  // operation can't fail.
 {
-  int e;
-
-  if (!(e = pthread_setspecific (cursor, (void *) drain)))
-	 return 1;
-  *err = (*err ? *err : (e == ENOMEM) ? e : (e = EAGAIN) ? e : THE_IER(76));
-  return 0;
+  cursor = drain;
+  return 1;
 }
 
 
@@ -130,13 +100,15 @@ _nthm_current_or_new_context (err)
 	  // context or create one and pool it with the root pipes. In the
 	  // latter case, the resulting pipe is a placeholder for an
 	  // unmanaged thread whose descendants correspond to managed
-	  // threads.
+	  // threads, and it belongs to the runtime selected by the
+	  // thread.
 {
   nthm_pipe drain;
 
   if ((drain = _nthm_current_context ()) ? 1 : ! (drain = _nthm_new_pipe (err)))
 	 return drain;
   drain->placeholder = 1;
+  drain->runtime = _nthm_selected_runtime ();
   if (! _nthm_placed (drain, err))
 	 goto a;
   if (_nthm_set_context (drain, err))
@@ -145,3 +117,63 @@ _nthm_current_or_new_context (err)
 	 IER(77);
   return NULL;
 }
+
+
+
+
+
+
+
+
+// --------------- runtime selection -----------------------------------------------------------------------
+
+
+
+
+
+
+nthm_runtime
+_nthm_selected_runtime ()
+
+	  // Return the runtime selected by the current thread, or the
+	  // default runtime if none has been selected.
+{
+  return (selection ? selection : _nthm_default_runtime ());
+}
+
+
+
+
+
+
+
+nthm_runtime
+_nthm_current_runtime ()
+
+	  // Return the runtime of the pipe associated with the current
+	  // thread if there is one, or the selected runtime otherwise.
+{
+  return (cursor ? cursor->runtime : _nthm_selected_runtime ());
+}
+
+
+
+
+
+
+
+nthm_runtime
+_nthm_select_runtime (runtime)
+	  nthm_runtime runtime;
+
+	  // Select a runtime for subsequent placeholders created in the
+	  // current thread and return the previous selection, with the
+	  // default runtime selected by a NULL runtime and reported as
+	  // NULL.
+{
+  nthm_runtime previous;
+
+  previous = selection;
+  selection = ((runtime == _nthm_default_runtime ()) ? NULL : runtime);
+  return previous;
+}
@@ -37,10 +37,14 @@ _nthm_clear_context (int *err);
 extern nthm_pipe
 _nthm_current_or_new_context (int *err);
 
-// eagerly create the thread specific storage key
-extern int
-_nthm_open_context (int *err);
+// return the runtime selected by the current thread or the default runtime
+extern nthm_runtime
+_nthm_selected_runtime (void);
 
-// free the thread specific storage key
-extern void
-_nthm_close_context (void);
+// return the runtime of the current thread's pipe if it has one or the selected runtime otherwise
+extern nthm_runtime
+_nthm_current_runtime (void);
+
+// select a runtime for placeholders subsequently created in the current thread and return the previous one
+extern nthm_runtime
+_nthm_select_runtime (nthm_runtime runtime);
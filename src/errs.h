@@ -18,11 +18,12 @@
 */
 
 #include <pthread.h>
+#include <nthm.h>
 
 // declarations related to error handling
 
-// the n-th internal error code
-#define THE_IER(n) (-n)
+// the n-th internal error code, which has to be a constant no greater than NTHM_MAX_ERR or the array size is negative
+#define THE_IER(n) (- (int) sizeof (char [((n) <= NTHM_MAX_ERR) ? (n) : -1]))
 
 // macro for raising an internal error without overwriting an existing error
 #define IER(n) (*err = (*err ? *err : THE_IER(n)))
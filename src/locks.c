@@ -0,0 +1,424 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
+#include <pthread.h>
+#include "errs.h"
+#include "locks.h"
+#ifdef USE_FUTEXES
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// A lock is a pair of 32-bit words, one for threads acquiring it and
+// one for threads waiting on either condition, so that releasing the
+// lock and sending a signal don't wake each other's sleepers. The
+// lock word holds only flags. The low bit of the signal word is a
+// flag and the rest count signals. Both conditions share the count, so
+// a thread waiting for one condition may be woken by a signal to the
+// other and has to check for itself whether it should wait again.
+
+// set in the lock word while the lock is held
+#define LOCKED 1
+
+// set in the lock word when a thread may be sleeping until the lock is released
+#define CONTENDED 2
+
+// set in the signal word when a thread may be sleeping until a signal is sent
+#define WAITING 1
+
+// the increment to the signal word when a signal is sent
+#define TICK 2
+
+// mask for the signal count
+#define SEQUENCE (~((uint32_t) (TICK - 1)))
+
+#else
+
+// mutexes are created with these attributes
+static pthread_mutexattr_t mutex_attribute;
+
+#endif
+
+
+
+
+
+// --------------- initialization and teardown -------------------------------------------------------------
+
+
+
+
+
+
+int
+_nthm_open_locks (err)
+	  int *err;
+
+	  // Initialize static storage.
+{
+#ifdef USE_FUTEXES
+  return 1;
+#else
+  return _nthm_error_checking_mutex_type (&mutex_attribute, err);
+#endif
+}
+
+
+
+
+
+
+void
+_nthm_close_locks ()
+
+	  // Release static storage.
+{
+#ifndef USE_FUTEXES
+  _nthm_globally_throw (pthread_mutexattr_destroy (&mutex_attribute) ? THE_IER(360) : 0);
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_lock_init (l)
+	  pipe_lock l;
+
+	  // Initialize a lock, returning zero if successful and an error
+	  // number otherwise.
+{
+#ifdef USE_FUTEXES
+  __atomic_store_n (&(l->word), 0, __ATOMIC_RELAXED);
+  __atomic_store_n (&(l->sequence), 0, __ATOMIC_RELAXED);
+  return 0;
+#else
+  int e;
+
+  if ((e = pthread_cond_init (&(l->termination), NULL)))
+	 return e;
+  if ((e = pthread_cond_init (&(l->progress), NULL)))
+	 goto a;
+  if (!(e = pthread_mutex_init (&(l->mutex), &mutex_attribute)))
+	 return 0;
+  pthread_cond_destroy (&(l->progress));
+ a: pthread_cond_destroy (&(l->termination));
+  return e;
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_lock_destroy (l)
+	  pipe_lock l;
+
+	  // Release the resources of a lock, returning zero if successful
+	  // and an error number otherwise.
+{
+#ifdef USE_FUTEXES
+  return ((__atomic_load_n (&(l->word), __ATOMIC_RELAXED) & LOCKED) ? EBUSY : 0);
+#else
+  int e;
+
+  e = pthread_cond_destroy (&(l->termination));
+  if (! e)
+	 e = pthread_cond_destroy (&(l->progress));
+  return (e ? e : pthread_mutex_destroy (&(l->mutex)));
+#endif
+}
+
+
+
+
+
+// --------------- locking and signaling -------------------------------------------------------------------
+
+
+
+
+#ifdef USE_FUTEXES
+
+static void
+slept (w, expected)
+	  uint32_t *w;
+	  uint32_t expected;
+
+	  // Sleep until woken if the word still holds the expected value.
+{
+  syscall ((long) SYS_futex, w, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+
+
+
+
+
+static void
+woken (w, n)
+	  uint32_t *w;
+	  int n;
+
+	  // Wake up to n threads sleeping on a word.
+{
+  syscall ((long) SYS_futex, w, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+
+
+
+
+
+static int
+waited (l)
+	  pipe_lock l;
+
+	  // Release a lock held by the caller, sleep until a signal is
+	  // sent unless one already has been, and acquire the lock
+	  // again. The sequence number read while the lock is held
+	  // detects signals sent after it's released but before the
+	  // caller is asleep.
+{
+  uint32_t s, c;
+
+  s = __atomic_or_fetch (&(l->sequence), WAITING, __ATOMIC_RELAXED) & SEQUENCE;
+  if (_nthm_unlock (l))
+	 return EPERM;
+  if (((c = __atomic_load_n (&(l->sequence), __ATOMIC_ACQUIRE)) & SEQUENCE) == s)
+	 slept (&(l->sequence), c);
+  return _nthm_lock (l);
+}
+
+
+
+
+
+
+static int
+signaled (l)
+	  pipe_lock l;
+
+	  // Advance the sequence number of a lock held by the caller and
+	  // wake the waiting threads, if any. A signal with no waiters
+	  // makes no system call. All of them are woken because waiters
+	  // for either condition may be sleeping on the same word, but
+	  // there are rarely more than one or two.
+{
+  if (__atomic_fetch_add (&(l->sequence), TICK, __ATOMIC_RELEASE) & WAITING)
+	 {
+		__atomic_fetch_and (&(l->sequence), ~((uint32_t) WAITING), __ATOMIC_RELAXED);
+		woken (&(l->sequence), INT_MAX);
+	 }
+  return 0;
+}
+
+#endif
+
+
+
+
+
+
+int
+_nthm_lock (l)
+	  pipe_lock l;
+
+	  // Acquire a lock. With futexes, a thread that has had to sleep
+	  // for the lock acquires it with the contended flag set, because
+	  // other threads might still be sleeping, so that they'll be
+	  // woken when it's released. Whenever a compare and swap fails,
+	  // the word is retried with the value it was found to have.
+{
+#ifdef USE_FUTEXES
+  uint32_t c, o, contended;
+
+  contended = 0;
+  c = __atomic_load_n (&(l->word), __ATOMIC_RELAXED);
+  while (1)
+	 if (! (c & LOCKED))
+		{
+		  if ((o = __sync_val_compare_and_swap (&(l->word), c, c | LOCKED | contended)) == c)
+			 return 0;
+		  c = o;
+		}
+	 else if ((c & CONTENDED) ? 0 : ((o = __sync_val_compare_and_swap (&(l->word), c, c | CONTENDED)) != c))
+		c = o;
+	 else
+		{
+		  slept (&(l->word), c | CONTENDED);
+		  contended = CONTENDED;
+		  c = __atomic_load_n (&(l->word), __ATOMIC_RELAXED);
+		}
+#else
+  return pthread_mutex_lock (&(l->mutex));
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_unlock (l)
+	  pipe_lock l;
+
+	  // Release a lock held by the caller. With futexes, a sleeping
+	  // thread is woken only if the lock is contended, and then only
+	  // one, which acquires the lock with the contended flag set so
+	  // that it wakes the next in turn.
+{
+#ifdef USE_FUTEXES
+  uint32_t c;
+
+  if (! ((c = __atomic_fetch_and (&(l->word), ~((uint32_t) (LOCKED | CONTENDED)), __ATOMIC_RELEASE)) & LOCKED))
+	 return EPERM;
+  if (c & CONTENDED)
+	 woken (&(l->word), 1);
+  return 0;
+#else
+  return pthread_mutex_unlock (&(l->mutex));
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_progress_wait (l)
+	  pipe_lock l;
+
+	  // Wait for a progress signal with the lock held.
+{
+#ifdef USE_FUTEXES
+  return waited (l);
+#else
+  return pthread_cond_wait (&(l->progress), &(l->mutex));
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_termination_wait (l)
+	  pipe_lock l;
+
+	  // Wait for a termination signal with the lock held.
+{
+#ifdef USE_FUTEXES
+  return waited (l);
+#else
+  return pthread_cond_wait (&(l->termination), &(l->mutex));
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_progress_signal (l)
+	  pipe_lock l;
+
+	  // Wake threads waiting for progress.
+{
+#ifdef USE_FUTEXES
+  return signaled (l);
+#else
+  return pthread_cond_signal (&(l->progress));
+#endif
+}
+
+
+
+
+
+
+int
+_nthm_termination_signal (l)
+	  pipe_lock l;
+
+	  // Wake threads waiting for termination.
+{
+#ifdef USE_FUTEXES
+  return signaled (l);
+#else
+  return pthread_cond_signal (&(l->termination));
+#endif
+}
+
+
+
+// --------------- statistics ------------------------------------------------------------------------------
+
+
+
+
+
+
+void
+_nthm_wait_counted (tally, polled, spun)
+	  struct nthm_statistics *tally;
+	  int polled;
+	  int spun;
+
+	  // Count a wait for a result in a tally, noting whether it polled
+	  // before sleeping and whether polling was enough to avoid
+	  // sleeping. The counts are only statistics, so they're updated
+	  // without ordering.
+{
+  __atomic_add_fetch (&(tally->waits), 1, __ATOMIC_RELAXED);
+  if (polled)
+	 __atomic_add_fetch (&(tally->polls), 1, __ATOMIC_RELAXED);
+  if (spun)
+	 __atomic_add_fetch (&(tally->spun), 1, __ATOMIC_RELAXED);
+}
+
+
+
+
+
+
+
+void
+_nthm_wait_counts (tally, s)
+	  struct nthm_statistics *tally;
+	  struct nthm_statistics *s;
+
+	  // Report the counts of waits in a tally.
+{
+  s->waits = __atomic_load_n (&(tally->waits), __ATOMIC_RELAXED);
+  s->polls = __atomic_load_n (&(tally->polls), __ATOMIC_RELAXED);
+  s->spun = __atomic_load_n (&(tally->spun), __ATOMIC_RELAXED);
+}
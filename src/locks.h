@@ -0,0 +1,116 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef NTHM_LOCKS_H
+#define NTHM_LOCKS_H 1
+
+#include <nthm.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "nthmconfig.h"
+
+// non-API routines for mutual exclusion and signaling on pipes, each
+// of which has a lock and two conditions waited on by its reader or
+// its own thread
+
+typedef struct pipe_lock_struct *pipe_lock;
+
+// hint to the processor that the caller is polling a location written by another thread
+#if defined (__x86_64__) || defined (__i386__)
+#define PAUSE() __builtin_ia32_pause ()
+#elif defined (__aarch64__)
+#define PAUSE() __asm__ __volatile__ ("yield" ::: "memory")
+#else
+#define PAUSE() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+#ifdef USE_FUTEXES
+
+struct pipe_lock_struct
+{
+  uint32_t word;              // lock and contention flags, slept on by threads waiting for the lock
+  uint32_t sequence;          // a waiting flag in the low bit and a signal count in the rest, slept on by threads waiting for signals
+};
+
+#else
+
+struct pipe_lock_struct
+{
+  pthread_mutex_t mutex;      // secures mutually exclusive access
+  pthread_cond_t progress;    // signaled when a pipe is killed or any of its blockers terminates
+  pthread_cond_t termination; // signaled when a pipe with no reader terminates
+};
+
+#endif
+
+// --------------- initialization and teardown -------------------------------------------------------------
+
+// initialize static storage
+extern int
+_nthm_open_locks (int *err);
+
+// release static storage
+extern void
+_nthm_close_locks (void);
+
+// initialize a lock, returning zero if successful and an error number otherwise
+extern int
+_nthm_lock_init (pipe_lock l);
+
+// release the resources of an unlocked lock
+extern int
+_nthm_lock_destroy (pipe_lock l);
+
+// --------------- locking and signaling -------------------------------------------------------------------
+
+// acquire a lock, returning zero if successful and an error number otherwise
+extern int
+_nthm_lock (pipe_lock l);
+
+// release a lock held by the caller
+extern int
+_nthm_unlock (pipe_lock l);
+
+// wait with a lock held for a progress signal, possibly returning spuriously
+extern int
+_nthm_progress_wait (pipe_lock l);
+
+// wait with a lock held for a termination signal, possibly returning spuriously
+extern int
+_nthm_termination_wait (pipe_lock l);
+
+// wake threads waiting for progress with the lock held
+extern int
+_nthm_progress_signal (pipe_lock l);
+
+// wake threads waiting for termination with the lock held
+extern int
+_nthm_termination_signal (pipe_lock l);
+
+// --------------- statistics ------------------------------------------------------------------------------
+
+// count a wait for a result in a tally, noting whether it polled and whether polling sufficed
+extern void
+_nthm_wait_counted (struct nthm_statistics *tally, int polled, int spun);
+
+// report the counts of waits in a tally
+extern void
+_nthm_wait_counts (struct nthm_statistics *tally, struct nthm_statistics *s);
+
+#endif
@@ -24,6 +24,7 @@
 #include <string.h>
 #include "errs.h"
 #include "pipes.h"
+#include "stock.h"
 #include "nthmconfig.h"
 #ifdef MEMTEST                  // keep counts of allocated structures; not suitable for production code
 #include <stdio.h>
@@ -55,16 +56,20 @@ _nthm_open_pipes (err)
 
 	  // Initialize static storage.
 {
-  if (! _nthm_error_checking_mutex_type (&mutex_attribute, err))
+  if (! _nthm_open_locks (err))
 	 return 0;
+  if (! _nthm_error_checking_mutex_type (&mutex_attribute, err))
+	 goto a;
 #ifdef MEMTEST
   if (pthread_mutex_init (&memtest_lock, &mutex_attribute) ? IER(84) : 0)
 	 {
 		pthread_mutexattr_destroy (&mutex_attribute);
-		return 0;
+		goto a;
 	 }
 #endif
   return 1;
+ a: _nthm_close_locks ();
+  return 0;
 }
 
 
@@ -79,6 +84,7 @@ _nthm_close_pipes ()
 	  // development and diagnostics.
 {
   _nthm_globally_throw (pthread_mutexattr_destroy (&mutex_attribute) ? THE_IER(85) : 0);
+  _nthm_close_locks ();
 #ifdef MEMTEST
   _nthm_globally_throw (pthread_mutex_destroy (&memtest_lock) ? THE_IER(86) : 0);
   if (pipes)
@@ -109,28 +115,22 @@ _nthm_new_pipe (err)
   nthm_pipe p;
   int e;
 
-  if ((p = (nthm_pipe) malloc (sizeof (*p))) ? 0 : (*err = (*err ? *err : ENOMEM)))
+  if (! (p = (nthm_pipe) _nthm_withdrawal (PIPE_STOCK, sizeof (*p), _Alignof (struct nthm_pipe_struct), err)))
 	 return NULL;
   memset (p, 0, sizeof (*p));
-  if ((e = pthread_cond_init (&(p->termination), NULL)))
+  if ((e = _nthm_lock_init (&(p->lock))))
 	 goto a;
-  if ((e = pthread_cond_init (&(p->progress), NULL)))
-	 goto b;
-  if ((e = pthread_mutex_init (&(p->lock), &mutex_attribute)))
-	 goto c;
   p->valid = MAGIC;
   if (! _nthm_scope_entered (p, err))
-	 goto d;
+	 goto b;
 #ifdef MEMTEST
   pthread_mutex_lock (&memtest_lock);
   pipes++;
   pthread_mutex_unlock (&memtest_lock);
 #endif
   return p;
- d: pthread_mutex_destroy (&(p->lock));
- c: pthread_cond_destroy (&(p->progress));
- b: pthread_cond_destroy (&(p->termination));
- a: free (p);
+ b: _nthm_lock_destroy (&(p->lock));
+ a: _nthm_deposit (PIPE_STOCK, p, sizeof (*p), err);
   *err = (*err ? *err : (e == ENOMEM) ? e : (e == EAGAIN) ? e : THE_IER(87));
   return NULL;
 }
@@ -150,28 +150,37 @@ _nthm_retired (p, err)
 	  int *err;
 
 	  // Tear down a pipe that has no drain, no enclosing scopes, and
-	  // no blockers or finishers left.
+	  // no blockers or finishers left. A result that's still there
+	  // hasn't been read and is passed to the destructor, if any. A
+	  // read result has already taken the pipe's arena with it, so
+	  // any arena left is freed after the destructor runs.
 {
   scope_stack e;
+  chunk arena;
 
   if ((! p) ? IER(88) : (p->valid != MAGIC) ? IER(89) : ((e = p->scope) ? 0 : IER(90)) ? (p->valid = MUGGLE(23)) : 0)
 	 return 0;
-  if (e->enclosure ? IER(91) : ! _nthm_scope_exited (p, err))
-	 return 0;
-  if ((pthread_cond_destroy (&(p->termination)) ? IER(92) : 0) ? (p->valid = MUGGLE(24)) : 0)
-	 return 0;
-  if ((pthread_cond_destroy (&(p->progress)) ? IER(93) : 0) ? (p->valid = MUGGLE(25)) : 0)
-	 return 0;
-  if ((pthread_mutex_destroy (&(p->lock)) ? IER(94) : 0) ? (p->valid = MUGGLE(26)) : 0)
+  if (p->level ? IER(91) : 0)
 	 return 0;
+  arena = _nthm_arena_detached (p, err);
+  if (! _nthm_scope_exited (p, err))
+	 goto a;
+  if ((_nthm_lock_destroy (&(p->lock)) ? IER(94) : 0) ? (p->valid = MUGGLE(26)) : 0)
+	 goto a;
   p->valid = MUGGLE(27);  // ensure detection of dangling references
-  free (p);
+  _nthm_release (p->spill, p->spilled);
+  if (p->result ? p->destructor : NULL)
+	 (p->destructor) (p->result);
+  _nthm_arena_adopted (NULL, arena, err);
+  _nthm_deposit (PIPE_STOCK, p, sizeof (*p), err);
 #ifdef MEMTEST
   pthread_mutex_lock (&memtest_lock);
   pipes--;
   pthread_mutex_unlock (&memtest_lock);
 #endif
   return 1;
+ a: _nthm_arena_adopted (NULL, arena, err);
+  return 0;
 }
 
 
@@ -192,7 +201,7 @@ _nthm_heritably_killed_or_yielded (source, err)
 
 	  // Detect whether source has yielded or been killed either
 	  // explicitly or due to any of its drains yielding or being
-	  // killed. It's necessary to lock each source, then lock its
+	  // killed or cancelled. It's necessary to lock each source, then lock its
 	  // drain, and then unlock the source all the way up the tree in
 	  // case any of them gets untethered.
 {
@@ -201,24 +210,87 @@ _nthm_heritably_killed_or_yielded (source, err)
 
   if ((!source) ? IER(95) : (source->valid != MAGIC) ? IER(96) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(97) : 0) ? (source->valid = MUGGLE(28)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(97) : 0) ? (source->valid = MUGGLE(28)) : 0)
 	 return 0;
   if (!(h = (source->yielded ? 1 : source->killed)))
 	 for (; source->reader; source = drain)
 		{
 		  if ((!(drain = source->reader->pipe)) ? IER(98) : (drain->valid != MAGIC) ? IER(99) : 0)
 			 break;
-		  if ((pthread_mutex_lock (&(drain->lock)) ? IER(100) : 0) ? (drain->valid = MUGGLE(29)) : 0)
+		  if ((_nthm_lock (&(drain->lock)) ? IER(100) : 0) ? (drain->valid = MUGGLE(29)) : 0)
 			 break;
-		  if ((h = (drain->yielded ? 1 : drain->killed)))
+		  if (((drain->level < source->depth) ? IER(410) : 0) ? (source->valid = MUGGLE(132)) : 0)
 			 goto a;
-		  if ((pthread_mutex_unlock (&(source->lock)) ? IER(101) : 0) ? (source->valid = MUGGLE(30)) : 0)
-			 return ((pthread_mutex_unlock (&(drain->lock)) ? IER(102) : 0) ? (! (drain->valid = MUGGLE(31))) : 0);
+		  if ((h = (drain->yielded ? 1 : drain->killed ? 1 : (drain->scopes[source->depth].epoch != source->epoch))))
+			 goto a;
+		  if ((_nthm_unlock (&(source->lock)) ? IER(101) : 0) ? (source->valid = MUGGLE(30)) : 0)
+			 return ((_nthm_unlock (&(drain->lock)) ? IER(102) : 0) ? (! (drain->valid = MUGGLE(31))) : 0);
 		  continue;
-		  a: if ((pthread_mutex_unlock (&(drain->lock)) ? IER(103) : 0) ? (drain->valid = MUGGLE(32)) : 1)
+		  a: if ((_nthm_unlock (&(drain->lock)) ? IER(103) : 0) ? (drain->valid = MUGGLE(32)) : 1)
 			 break;
 		}
-  return ((pthread_mutex_unlock (&(source->lock)) ? IER(104) : 0) ? (! (source->valid = MUGGLE(33))) : h);
+  return ((_nthm_unlock (&(source->lock)) ? IER(104) : 0) ? (! (source->valid = MUGGLE(33))) : h);
+}
+
+
+
+
+
+
+
+
+
+
+int
+_nthm_cancelled (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Detect whether a locked source has been cancelled by its drain
+	  // calling nthm_kill_all in the scope where the source was
+	  // tethered. The drain counts its cancellations in all scopes, so
+	  // the drain has to be locked to compare epochs only if the count
+	  // has changed since the source last looked. If the source turns
+	  // out not to be cancelled, the count is remembered. The count is
+	  // loaded in sequence with the source's sleeping and joining
+	  // flags, so that a source about to wait either sees that it's
+	  // been cancelled or is seen waiting by the drain and woken.
+{
+  nthm_pipe drain;
+  uintptr_t n;
+  int c;
+
+  if ((!source) ? IER(411) : (source->valid != MAGIC) ? IER(412) : ! (source->reader))
+	 return 0;
+  if ((!(drain = source->reader->pipe)) ? IER(413) : (drain->valid != MAGIC) ? IER(414) : 0)
+	 return 0;
+  if ((n = __atomic_load_n (&(drain->cancellations), __ATOMIC_SEQ_CST)) == source->seen)
+	 return 0;
+  if ((_nthm_lock (&(drain->lock)) ? IER(415) : 0) ? (drain->valid = MUGGLE(133)) : 0)
+	 return 0;
+  if (!(c = ((drain->level < source->depth) ? ! IER(416) : (drain->scopes[source->depth].epoch != source->epoch))))
+	 source->seen = n;
+  return (((_nthm_unlock (&(drain->lock)) ? IER(417) : 0) ? (drain->valid = MUGGLE(134)) : 0) ? 0 : c);
+}
+
+
+
+
+
+
+
+
+
+
+int
+_nthm_killed_or_cancelled (p, err)
+	  nthm_pipe p;
+	  int *err;
+
+	  // Detect whether a locked pipe p waiting for its sources should
+	  // stop waiting because it's been killed or cancelled.
+{
+  return (p->killed ? 1 : _nthm_cancelled (p, err));
 }
 
 
@@ -238,40 +310,36 @@ _nthm_heritably_truncated (source, err)
 	  // Detect whether source has been truncated either explicitly or
 	  // due to any of its drains being truncated. The truncation
 	  // status depends on the scope in which the pipe is opened,
-	  // unlike heritable killed or yielded status, which are global.
+	  // unlike heritable killed or yielded status, which are global. A
+	  // cancelled source is fully truncated, just as a killed one is.
 {
   nthm_pipe drain;
-  uintptr_t l;         // scope level counter
-  scope_stack e;       // local scope
   unsigned h;          // return value
 
   if ((!source) ? IER(105) : (source->valid != MAGIC) ? IER(106) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(107) : 0) ? (source->valid = MUGGLE(34)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(107) : 0) ? (source->valid = MUGGLE(34)) : 0)
 	 return 0;
   if (!(h = (unsigned) (source->yielded ? 1 : source->killed)))
 	 for (; source->reader; source = drain)
 		{
 		  if ((!(drain = source->reader->pipe)) ? IER(108) : (drain->valid != MAGIC) ? IER(109) : 0)
 			 break;
-		  if ((pthread_mutex_lock (&(drain->lock)) ? IER(110) : 0) ? (drain->valid = MUGGLE(35)) : 0)
+		  if ((_nthm_lock (&(drain->lock)) ? IER(110) : 0) ? (drain->valid = MUGGLE(35)) : 0)
 			 break;
-		  if (((e = drain->scope) ? 0 : IER(111)) ? (drain->valid = MUGGLE(36)) : 0)
+		  if ((drain->scope ? 0 : IER(111)) ? (drain->valid = MUGGLE(36)) : 0)
 			 goto a;
-		  if ((((l = _nthm_scope_level (drain, err)) < source->depth) ? IER(112) : 0) ? (source->valid = MUGGLE(37)) : 0)
+		  if (((drain->level < source->depth) ? IER(112) : 0) ? (source->valid = MUGGLE(37)) : 0)
 			 goto a;
-		  for (l = l - source->depth; l; l--)
-			 if (((e = e->enclosure) ? 0 : IER(113)) ? (drain->valid = MUGGLE(38)) : 0)
-				goto a;
-		  if ((h = e->truncation))
+		  if ((h = ((drain->scopes[source->depth].epoch != source->epoch) ? 1 : drain->scopes[source->depth].truncation)))
 			 goto a;
-		  if ((pthread_mutex_unlock (&(source->lock)) ? IER(114) : 0) ? (source->valid = MUGGLE(39)) : 0)
-			 return ((pthread_mutex_unlock (&(drain->lock)) ? IER(115) : 0) ? ((unsigned) !(drain->valid = MUGGLE(40))) : 0);
+		  if ((_nthm_unlock (&(source->lock)) ? IER(114) : 0) ? (source->valid = MUGGLE(39)) : 0)
+			 return ((_nthm_unlock (&(drain->lock)) ? IER(115) : 0) ? ((unsigned) !(drain->valid = MUGGLE(40))) : 0);
 		  continue;
-		a: if ((pthread_mutex_unlock (&(drain->lock)) ? IER(116) : 0) ? (drain->valid = MUGGLE(41)) : 1)
+		a: if ((_nthm_unlock (&(drain->lock)) ? IER(116) : 0) ? (drain->valid = MUGGLE(41)) : 1)
 			 break;
 		}
-  return ((pthread_mutex_unlock (&(source->lock)) ? IER(117) : 0) ? ((unsigned) ! (source->valid = MUGGLE(42))) : h);
+  return ((_nthm_unlock (&(source->lock)) ? IER(117) : 0) ? ((unsigned) ! (source->valid = MUGGLE(42))) : h);
 }
 
 
@@ -299,10 +367,9 @@ _nthm_retirable (p, err)
   q = 0;
   if ((! p) ? IER(118) : (p->valid != MAGIC) ? IER(119) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(p->lock)) ? IER(120) : 0) ? (p->valid = MUGGLE(43)) : 0)
+  if ((_nthm_lock (&(p->lock)) ? IER(120) : 0) ? (p->valid = MUGGLE(43)) : 0)
 	 return 0;
-  if (! (p->zombie))
-	 if (!(((e = p->scope) ? 0 : IER(121)) ? (p->valid = MUGGLE(44)) : (q = 0)))
-		q = (e->enclosure ? 0 : e->blockers ? 0 : e->finishers ? 0 : p->placeholder ? 1 : p->yielded ? p->killed : 0);
-  return (((pthread_mutex_unlock (&(p->lock)) ? IER(122) : 0) ? (p->valid = MUGGLE(45)) : 0) ? 0 : p->zombie ? 1 : q);
+  if (!(((e = p->scope) ? 0 : IER(121)) ? (p->valid = MUGGLE(44)) : (q = 0)))
+	 q = (p->level ? 0 : e->blockers ? 0 : e->finishers ? 0 : e->casualties ? 0 : p->fallen ? 0 : p->placeholder ? 1 : p->yielded ? p->killed : 0);
+  return (((_nthm_unlock (&(p->lock)) ? IER(122) : 0) ? (p->valid = MUGGLE(45)) : 0) ? 0 : q);
 }
@@ -19,25 +19,63 @@
 
 // non-API non-mutating operations on the nthm_pipe data structure
 
+#ifndef NTHM_PIPES_H
+#define NTHM_PIPES_H 1
+
 #include <nthm.h>
 #include "scopes.h"
+#include "locks.h"
 
 struct nthm_pipe_struct
 {
+  // written when the pipe is created and read thereafter
   int valid;                  // holds a muggle if any pthread operation or integrity check fails, MAGIC otherwise
+  int placeholder;            // set for the unmanaged thread at the root of a tree of pipes
+  int write_only;             // set for pipes created by nthm_send, whose results are never read
+  int limited;                // set if the thread started for this pipe counts against its runtime's thread limit
+  nthm_runtime runtime;       // owner of the root pool and thread accounting for this pipe
+  nthm_worker operator;       // user code run by the thread if the pipe is readable
+  nthm_slacker mutator;       // user code run by the thread if the pipe is write-only
+  void *operand;              // passed to the operator or mutator when the thread starts
+  void *spill;                // heap storage for a copied operand too large to fit in the pipe, if any
+  size_t spilled;             // the size of the spill, needed to free it
+  nthm_destructor destructor; // if non-NULL, applied to the result if it's discarded without being read
+  union
+  {
+	 max_align_t alignment;    // ensures suitable alignment for any copied operand
+	 unsigned char bytes[NTHM_OPERAND_MAX];
+  } copy;                     // storage for an operand copied by nthm_open_copy
+  // written by the reader or whatever thread tethers or untethers the pipe
   int killed;                 // set either by user code or by the reader yielding without having read from the pipe
-  int zombie;                 // not in use but unable to be freed because something points to it
-  int yielded;                // set by the thread when its result is finished being computed
   pipe_list pool;             // root neighbors if the pipe is untethered
   pipe_list reader;           // a list of at most one pipe designated to read the result from this one
-  pthread_cond_t progress;    // signaled by the reader thread when this one is killed or by any blocker that terminates
-  pthread_cond_t termination; // signaled by the thread to indicate termination if it has no reader
-  pthread_mutex_t lock;       // secures mutually exclusive access for otherwise non-atomic operations on this structure
-  scope_stack scope;          // pipes corresponding to enclosing scopes
   uintptr_t depth;            // number of enclosing scopes to the drain at the time this source was created
-  int placeholder;            // set for the unmanaged thread at the root of a tree of pipes
-  void *result;               // returned by user code in the thread when it terminates
+  uintptr_t epoch;            // the epoch of the drain's scope at that depth when this source was tethered
+  uintptr_t seen;             // the drain's cancellations as of when this source last found itself not cancelled
+  // written by every thread that synchronizes on the pipe
+  struct pipe_lock_struct lock; // secures mutually exclusive access and signals progress or termination
+  nthm_pipe arrivals;         // sources pushed here without locking when they yield, until collected into finishers
+  int sleeping;               // set while the drain waits for progress so that the first source to arrive signals it
+  uintptr_t joining;          // one more than the scope level being joined by nthm_read_all, zero otherwise
+  uintptr_t pending;          // number of sources in the joined scope that haven't yet been counted as arriving
+  int tallied;                // set when this source has been counted off the pending sources of its drain
+  uintptr_t cancellations;    // number of times nthm_kill_all has been called in any scope of this drain
+  pipe_list fallen;           // cancelled sources collected from the arrivals and waiting to be retired
+  pipe_list queued;           // complement of this pipe's entry in its runtime's queue while it waits for a thread
+  nthm_notifier notifier;     // called on the notice once the pipe yields, if set by nthm_notify
+  void *notice;               // passed to the notifier
+  nthm_notifier herald;       // called on the heralded context once a source in the heralded scope yields, if set by nthm_notify_select
+  void *heralded;             // passed to the herald
+  uintptr_t herald_depth;     // the scope level that was current when the herald was set
+  // written by the thread running in the pipe's context
+  scope_stack scope;          // the innermost enclosing scope, at the top of the scope stack
+  scope_stack scopes;         // an array of enclosing scopes indexed by scope level
+  uintptr_t level;            // current scope level, indexing the innermost scope
+  uintptr_t room;             // number of scopes for which the array has room
+  int yielded;                // set by the thread when its result is finished being computed
+  nthm_pipe arrival;          // the next source in the drain's arrivals after this one
   int status;                 // an error code returned by user code if not overridden by other conditions
+  void *result;               // returned by user code in the thread when it terminates
 };
 
 // --------------- memory management -----------------------------------------------------------------------
@@ -64,6 +102,14 @@ _nthm_retired (nthm_pipe p, int *err);
 extern int
 _nthm_heritably_killed_or_yielded (nthm_pipe source, int *err);
 
+// return non-zero if a locked source has been cancelled by nthm_kill_all in the scope of its drain
+extern int
+_nthm_cancelled (nthm_pipe source, int *err);
+
+// return non-zero if a locked pipe has been killed or cancelled
+extern int
+_nthm_killed_or_cancelled (nthm_pipe p, int *err);
+
 // return the truncation level if the source has been truncated indrectly
 extern unsigned
 _nthm_heritably_truncated (nthm_pipe source, int *err);
@@ -71,3 +117,5 @@ _nthm_heritably_truncated (nthm_pipe source, int *err);
 // safely test whether a pipe is ready to be retired
 extern int
 _nthm_retirable (nthm_pipe p, int *err);
+
+#endif
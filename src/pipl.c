@@ -22,6 +22,7 @@
 #include <errno.h>
 #include "errs.h"
 #include "pipl.h"
+#include "stock.h"
 #include "nthmconfig.h"
 #ifdef MEMTEST
 #include <stdio.h>
@@ -109,7 +110,7 @@ _nthm_pipe_list_of (p, err)
   pthread_once (&once_control, lazy_initialization);
 #endif
   t = NULL;
-  if ((p ? 0 : IER(126)) ? 1 : (t = (pipe_list) malloc (sizeof (*t))) ? 0 : (*err = (*err ? *err : ENOMEM)))
+  if ((p ? 0 : IER(126)) ? 1 : ! (t = (pipe_list) _nthm_withdrawal (PIPE_LIST_STOCK, sizeof (*t), _Alignof (struct pipe_list_struct), err)))
 	 return NULL;
 #ifdef MEMTEST
   pthread_mutex_lock (&memtest_lock);
@@ -251,7 +252,7 @@ _nthm_freed (r, err)
 		  return 0;
 		r->complement->complement = NULL;
 	 }
-  free (r);
+  _nthm_deposit (PIPE_LIST_STOCK, r, sizeof (*r), err);
 #ifdef MEMTEST
   pthread_mutex_lock (&memtest_lock);
   pipe_lists--;
@@ -24,6 +24,9 @@
 #include "scopes.h"
 #include "context.h"
 #include "pool.h"
+#include "runtime.h"
+#include "protocol.h"
+#include "sync.h"
 #include "errs.h"
 
 
@@ -56,11 +59,11 @@ _nthm_tethered (s, d, err)
 
   if ((! d) ? IER(159) : (d->valid != MAGIC) ? IER(160) : (! s) ? IER(161) : (s->valid != MAGIC) ? IER(162) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(s->lock)) ? IER(163) : 0) ? (s->valid = MUGGLE(46)) : 0)
+  if ((_nthm_lock (&(s->lock)) ? IER(163) : 0) ? (s->valid = MUGGLE(46)) : 0)
 	 return 0;
   if ((!(s->reader)) ? (t = 0) : _nthm_drained_by (s, d, err) ? (t = 1) : ! (t = ! (*err = (*err ? *err : NTHM_NOTDRN))))
 	 goto a;
-  if (s->killed ? IER(164) : (pthread_mutex_lock (&(d->lock)) ? IER(165) : 0) ? (d->valid = MUGGLE(47)) : 0)
+  if (s->killed ? IER(164) : (_nthm_lock (&(d->lock)) ? IER(165) : 0) ? (d->valid = MUGGLE(47)) : 0)
 	 goto a;
   if (((e = d->scope) ? 0 : IER(166)) ? (d->valid = MUGGLE(48)) : ! _nthm_new_complementary_pipe_lists (&r, d, &w, s, err))
 	 goto b;
@@ -68,12 +71,16 @@ _nthm_tethered (s, d, err)
 	 goto b;
   t = (s->yielded ? _nthm_enqueued (w, &(e->finishers), &(e->finisher_queue), err) : _nthm_pushed (w, &(e->blockers), err));
   if (t)
-	 s->depth = _nthm_scope_level (d, err);
+	 {
+		s->depth = _nthm_scope_level (d, err);
+		s->epoch = e->epoch;
+		s->seen = __atomic_load_n (&(d->cancellations), __ATOMIC_RELAXED);
+	 }
   else if (!(_nthm_freed (w, err) ? _nthm_unilaterally_delisted (&(s->reader), err) : NULL))
 	 s->valid = MUGGLE(49);
- b: if (pthread_mutex_unlock (&(d->lock)) ? IER(168) : 0)
+ b: if (_nthm_unlock (&(d->lock)) ? IER(168) : 0)
 	 d->valid = MUGGLE(50);
- a: if (pthread_mutex_unlock (&(s->lock)) ? IER(169) : 0)
+ a: if (_nthm_unlock (&(s->lock)) ? IER(169) : 0)
 	 s->valid = MUGGLE(51);
   _nthm_displace (s, err);
   return t;
@@ -108,17 +115,17 @@ _nthm_untethered (s, err)
 	 return 0;
   if ((! d) ? IER(172) : (d->valid != MAGIC) ? IER(173) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(s->lock)) ? IER(174) : 0) ? (s->valid = MUGGLE(52)) : 0)
+  if ((_nthm_lock (&(s->lock)) ? IER(174) : 0) ? (s->valid = MUGGLE(52)) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(175) : 0) ? (d->valid = MUGGLE(53)) : 0)
+  if ((_nthm_lock (&(d->lock)) ? IER(175) : 0) ? (d->valid = MUGGLE(53)) : 0)
 	 goto a;
-  if (((e = d->scope) ? 0 : IER(176)) ? (d->valid = MUGGLE(54)) : 0)
+  if (((e = d->scope) ? 0 : IER(176)) ? (d->valid = MUGGLE(54)) : ! _nthm_collected (d, err))
 	 goto b;
   if (! (done = (s == _nthm_bilaterally_dequeued (s->reader, &(e->finishers), &(e->finisher_queue), err))))
 	 s->valid = d->valid = MUGGLE(55);
- b: if (pthread_mutex_unlock (&(d->lock)) ? IER(177) : 0)
+ b: if (_nthm_unlock (&(d->lock)) ? IER(177) : 0)
 	 d->valid = MUGGLE(56);
- a: if (pthread_mutex_unlock (&(s->lock)) ? IER(178) : 0)
+ a: if (_nthm_unlock (&(s->lock)) ? IER(178) : 0)
 	 s->valid = MUGGLE(57);
   if (done)
 	 _nthm_unpool (d, err);
@@ -133,30 +140,243 @@ _nthm_untethered (s, err)
 
 
 
+int
+_nthm_collected (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Move the sources that have yielded to a drain d from its
+	  // blockers to the finishers of the scopes they were opened
+	  // in. Sources push themselves onto the drain's arrivals without
+	  // locking the drain, so that they don't contend with each
+	  // other or with the drain when many finish together. The drain
+	  // is assumed to be locked on entry and takes all of them at
+	  // once. They're reversed before being enqueued so that they
+	  // stay in the order they finished. Sources that were cancelled
+	  // by nthm_kill_all after being tethered are moved to the fallen
+	  // list instead, where they wait to be retired. If the drain is
+	  // joining the scope of a source, the source is counted off the
+	  // pending ones unless it has already counted itself.
+{
+  nthm_pipe a, r, s;
+  scope_stack e;
+  pipe_list b;
+
+  if ((! d) ? IER(363) : (d->valid != MAGIC) ? IER(364) : 0)
+	 return 0;
+  r = NULL;
+  for (a = __atomic_exchange_n (&(d->arrivals), NULL, __ATOMIC_SEQ_CST); (s = a); r = s)
+	 {
+		a = s->arrival;
+		s->arrival = r;
+	 }
+  while ((s = r))
+	 {
+		r = s->arrival;
+		s->arrival = NULL;
+		if ((s->valid != MAGIC) ? IER(365) : (! (s->reader)) ? IER(366) : (s->reader->pipe != d) ? IER(367) : (d->level < s->depth) ? IER(368) : 0)
+		  return ! (d->valid = MUGGLE(108));
+		e = d->scopes + s->depth;
+		if (! _nthm_severed (b = s->reader->complement, err))
+		  return ! (d->valid = MUGGLE(109));
+		if (! ((e->epoch != s->epoch) ? _nthm_pushed (b, &(d->fallen), err) : _nthm_enqueued (b, &(e->finishers), &(e->finisher_queue), err)))
+		  return ! (d->valid = MUGGLE(174));
+		if ((d->joining != s->depth + 1) ? 0 : ! __atomic_exchange_n (&(s->tallied), 1, __ATOMIC_ACQ_REL))
+		  __atomic_sub_fetch (&(d->pending), 1, __ATOMIC_ACQ_REL);
+	 }
+  return 1;
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_awaited (d, polls, err)
+	  nthm_pipe d;
+	  unsigned long polls;
+	  int *err;
+
+	  // Collect the arrivals to a locked drain d if there are any, and
+	  // otherwise wait for progress unless some arrive in the meantime.
+	  // Arrivals already pushed may have found the drain awake and not
+	  // signaled it, so the drain doesn't sleep after collecting them.
+	  // If polls is non-zero, the drain is unlocked and its arrivals and
+	  // killed flag are polled up to that many times before it's put to
+	  // sleep, which is cheaper when sources are expected to finish
+	  // soon. A source signals the drain only if it's the first to
+	  // arrive since the last collection and the drain is sleeping, so
+	  // the drain has to say that it's sleeping before checking for
+	  // arrivals one last time. Either the drain sees the arrival or the
+	  // source sees the drain sleeping and waits for the lock to signal
+	  // it. The drain likewise checks whether it's been cancelled after
+	  // saying that it's sleeping, so that either it sees the
+	  // cancellation or its canceller sees it sleeping and wakes it. If
+	  // any source in the drain's current scope is still waiting for a
+	  // thread, the drain's thread runs it instead of waiting, which
+	  // counts as progress.
+{
+  unsigned long i;
+  nthm_pipe s;
+  int e, parked;
+
+  if (__atomic_load_n (&(d->arrivals), __ATOMIC_ACQUIRE))
+	 return _nthm_collected (d, err);
+  if (! (s = _nthm_claimed_blocker (d, err)))
+	 goto b;
+  if ((_nthm_unlock (&(d->lock)) ? IER(510) : 0) ? (d->valid = MUGGLE(156)) : 0)
+	 return 0;
+  _nthm_inlined (s, err);
+  return ! ((_nthm_lock (&(d->lock)) ? IER(511) : 0) ? (d->valid = MUGGLE(157)) : 0);
+ b: if (! polls)
+	 goto a;
+  if ((_nthm_unlock (&(d->lock)) ? IER(370) : 0) ? (d->valid = MUGGLE(111)) : 0)
+	 return 0;
+  for (i = 0; (i < polls) ? ! (__atomic_load_n (&(d->arrivals), __ATOMIC_ACQUIRE) ? 1 : __atomic_load_n (&(d->killed), __ATOMIC_RELAXED)) : 0; i++)
+	 PAUSE ();
+  if ((_nthm_lock (&(d->lock)) ? IER(371) : 0) ? (d->valid = MUGGLE(112)) : 0)
+	 return 0;
+ a: e = 0;
+  __atomic_store_n (&(d->sleeping), 1, __ATOMIC_SEQ_CST);
+  if ((parked = (_nthm_killed_or_cancelled (d, err) ? 0 : ! __atomic_load_n (&(d->arrivals), __ATOMIC_SEQ_CST))))
+	 e = _nthm_progress_wait (&(d->lock));
+  __atomic_store_n (&(d->sleeping), 0, __ATOMIC_RELAXED);
+  _nthm_wait_counted (&(d->runtime->tally), ! ! polls, polls ? ! parked : 0);
+  return ! ((e ? IER(369) : 0) ? (d->valid = MUGGLE(110)) : 0);
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_joined (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Wait until every source in the current scope of a locked drain d
+	  // has yielded and been collected into its finishers, unless d is
+	  // killed or cancelled, while being woken only once. The drain
+	  // counts its blockers and publishes the count and the scope level,
+	  // so that sources arriving from that scope count themselves off,
+	  // and only the last one signals. Sources check the level after
+	  // pushing themselves onto the arrivals and the drain collects
+	  // after publishing it, so each source is either seen by the drain
+	  // or sees the level, and the tallied flag ensures it's counted
+	  // only once if both. Cancelled sources in the scope are waited for
+	  // as well because they can't tell that they've been cancelled
+	  // without locking the drain. Sources from enclosing scopes don't
+	  // signal the drain while it's joining because it isn't marked as
+	  // sleeping. Sources in the scope still waiting for a thread are
+	  // first run in the drain's thread.
+{
+  scope_stack e;
+  pipe_list b;
+  nthm_pipe s;
+  uintptr_t n;
+  int w;
+
+  if ((! d) ? IER(536) : (d->valid != MAGIC) ? IER(537) : ((e = d->scope) ? 0 : IER(538)) ? (d->valid = MUGGLE(171)) : 0)
+	 return 0;
+  if (! _nthm_collected (d, err))
+	 return 0;
+  while ((s = _nthm_claimed_blocker (d, err)))
+	 {
+		if ((_nthm_unlock (&(d->lock)) ? IER(512) : 0) ? (d->valid = MUGGLE(158)) : 0)
+		  return 0;
+		_nthm_inlined (s, err);
+		if ((_nthm_lock (&(d->lock)) ? IER(513) : 0) ? (d->valid = MUGGLE(159)) : ! _nthm_collected (d, err))
+		  return 0;
+	 }
+  for (n = 0, b = e->blockers; b; b = b->next_pipe)
+	 n++;
+  for (b = e->casualties; b; b = b->next_pipe)
+	 n++;
+  if (! n)
+	 return 1;
+  __atomic_store_n (&(d->pending), n, __ATOMIC_SEQ_CST);
+  __atomic_store_n (&(d->joining), d->level + 1, __ATOMIC_SEQ_CST);
+  for (w = 0; _nthm_killed_or_cancelled (d, err) ? 0 : (! _nthm_collected (d, err)) ? 0 : ! ! __atomic_load_n (&(d->pending), __ATOMIC_ACQUIRE); w = 1)
+	 if ((_nthm_progress_wait (&(d->lock)) ? IER(539) : 0) ? (d->valid = MUGGLE(172)) : 0)
+		break;
+  __atomic_store_n (&(d->joining), 0, __ATOMIC_SEQ_CST);
+  if (w)
+	 _nthm_wait_counted (&(d->runtime->tally), 0, 0);
+  return ((d->valid == MAGIC) ? _nthm_collected (d, err) : 0);
+}
+
+
+
+
+
+
+
+
+
 int
 _nthm_descendants_untethered (p, err)
 	  nthm_pipe p;
 	  int *err;
 
-	  // Untether all blockers and finishers under a pipe p.
+	  // Untether all blockers and finishers under a pipe p. The lists
+	  // are detached from the current scope at once and their sources
+	  // are inserted into the root pool together, with the casualties
+	  // being killed as well. Blockers and casualties that yield while
+	  // this is happening are left in the detached lists, because
+	  // they're already in the arrivals, and then collected back into
+	  // the finishers and untethered individually, or into the fallen
+	  // sources and retired.
 {
   scope_stack e;
-  pipe_list c;
+  pipe_list c, f, b, k;
 
   if ((! p) ? IER(179) : (p->valid != MAGIC) ? IER(180) : 0)
 	 return 0;
+  f = b = k = NULL;
+  if ((_nthm_lock (&(p->lock)) ? IER(404) : 0) ? (p->valid = MUGGLE(126)) : 0)
+	 return 0;
+  if ((((e = p->scope) ? 0 : IER(405)) ? (p->valid = MUGGLE(127)) : 0) ? 0 : _nthm_collected (p, err))
+	 {
+		if ((f = e->finishers))
+		  f->previous_pipe = &f;
+		if ((b = e->blockers))
+		  b->previous_pipe = &b;
+		if ((k = e->casualties))
+		  k->previous_pipe = &k;
+		e->finishers = e->finisher_queue = e->blockers = e->casualties = NULL;
+	 }
+  if ((_nthm_unlock (&(p->lock)) ? IER(406) : 0) ? (p->valid = MUGGLE(128)) : (p->valid != MAGIC))
+	 return 0;
+  if (!(_nthm_relocated (p->runtime, &f, 0, 0, err) ? _nthm_relocated (p->runtime, &b, 1, 0, err) ? _nthm_relocated (p->runtime, &k, 1, 1, err) : 0 : 0))
+	 return 0;
+  if (b ? 0 : ! k)
+	 return _nthm_fallen_retired (p, err);
+  if ((_nthm_lock (&(p->lock)) ? IER(407) : 0) ? (p->valid = MUGGLE(129)) : 0)
+	 return 0;
+  if ((_nthm_collected (p, err) ? (b ? b : k) : NULL) ? IER(408) : 0)
+	 p->valid = MUGGLE(130);
+  if ((_nthm_unlock (&(p->lock)) ? IER(409) : 0) ? (p->valid = MUGGLE(131)) : (p->valid != MAGIC))
+	 return 0;
   do
 	 {
-		if ((pthread_mutex_lock (&(p->lock)) ? IER(181) : 0) ? (p->valid = MUGGLE(58)) : 0)
+		if ((_nthm_lock (&(p->lock)) ? IER(181) : 0) ? (p->valid = MUGGLE(58)) : 0)
 		  return 0;
 		if (((e = p->scope) ? 0 : IER(182)) ? (p->valid = MUGGLE(59)) : 0)
-		  return ((pthread_mutex_unlock (&(p->lock)) ? IER(183) : 0) ? (!(p->valid = MUGGLE(60))) : 0);
+		  return ((_nthm_unlock (&(p->lock)) ? IER(183) : 0) ? (!(p->valid = MUGGLE(60))) : 0);
 		c = (e->finishers ? e->finishers : e->blockers);
-		if ((pthread_mutex_unlock (&(p->lock)) ? IER(184) : 0) ? (p->valid = MUGGLE(61)) : 0)
+		if ((_nthm_unlock (&(p->lock)) ? IER(184) : 0) ? (p->valid = MUGGLE(61)) : 0)
 		  return 0;
 	 }
   while (c ? _nthm_untethered (c->pipe, err) : 0);
-  return 1;
+  return _nthm_fallen_retired (p, err);
 }
 
 
@@ -181,12 +401,12 @@ _nthm_killable (s, err)
 {
   if ((!s) ? IER(185) : (s->valid != MAGIC) ? IER(186) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(s->lock)) ? IER(187) : 0) ? (s->valid = MUGGLE(62)) : 0)
+  if ((_nthm_lock (&(s->lock)) ? IER(187) : 0) ? (s->valid = MUGGLE(62)) : 0)
 	 return 0;
   s->killed = 1;
-  if (s->yielded ? 0 : pthread_cond_signal (&(s->progress)) ? IER(188) : 0)
+  if (s->yielded ? 0 : _nthm_progress_signal (&(s->lock)) ? IER(188) : 0)
 	 s->valid = MUGGLE(63);
-  return ((pthread_mutex_unlock (&(s->lock)) ? IER(189) : 0) ? (!(s->valid = MUGGLE(64))) : _nthm_untethered (s, err));
+  return ((_nthm_unlock (&(s->lock)) ? IER(189) : 0) ? (!(s->valid = MUGGLE(64))) : _nthm_untethered (s, err));
 }
 
 
@@ -198,36 +418,38 @@ _nthm_killable (s, err)
 
 
 static int
-blockers_killed (d, err)
+blockers_killed (d, placeholding, err)
 	  nthm_pipe d;
+	  int placeholding;
 	  int *err;
 
-	  // This function run in the drain's context kills all blockers to
-	  // the drain. The drain has to be locked long enough to get a
-	  // blocker from the list without the list being mutated, but the
-	  // lock has to be let off the drain temporarily before
-	  // untethering the blocker.
+	  // This function run in the drain's context kills all blockers
+	  // and casualties to the drain. The drain has to be locked long
+	  // enough to get a blocker from the list without the list being
+	  // mutated, but the lock has to be let off the drain temporarily
+	  // before untethering the blocker. The drain may be a placeholder
+	  // only if placeholding is requested.
 {
   nthm_pipe s;
   scope_stack e;
   int done;
 
-  if ((! d) ? IER(190) : (d->valid != MAGIC) ? IER(191) : d->placeholder ? IER(192) : 0)
+  if ((! d) ? IER(190) : (d->valid != MAGIC) ? IER(191) : placeholding ? 0 : d->placeholder ? IER(192) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(193) : 0) ? (d->valid = MUGGLE(65)) : 0)
+  if ((_nthm_lock (&(d->lock)) ? IER(193) : 0) ? (d->valid = MUGGLE(65)) : 0)
 	 return 0;
   if (d->yielded ? IER(194) : ((e = d->scope) ? 0 : IER(195)) ? (d->valid = MUGGLE(66)) : 0)
-	 return ((pthread_mutex_unlock (&(d->lock)) ? IER(196) : 0) ? (!(d->valid = MUGGLE(67))) : 0);
-  while (! (done = ! (e->blockers)))
+	 return ((_nthm_unlock (&(d->lock)) ? IER(196) : 0) ? (!(d->valid = MUGGLE(67))) : 0);
+  while (! (done = ! (e->blockers ? e->blockers : e->casualties)))
 	 {
-		if ((s = e->blockers->pipe) ? 0 : (d->valid = MUGGLE(68)))
+		if ((s = (e->blockers ? e->blockers : e->casualties)->pipe) ? 0 : (d->valid = MUGGLE(68)))
 		  break;
-		if ((pthread_mutex_unlock (&(d->lock)) ? IER(197) : 0) ? (d->valid = MUGGLE(69)) : ! _nthm_killable (s, err))
+		if ((_nthm_unlock (&(d->lock)) ? IER(197) : 0) ? (d->valid = MUGGLE(69)) : ! _nthm_killable (s, err))
 		  return 0;
-		if ((pthread_mutex_lock (&(d->lock)) ? IER(198) : 0) ? (d->valid = MUGGLE(70)) : 0)
+		if ((_nthm_lock (&(d->lock)) ? IER(198) : 0) ? (d->valid = MUGGLE(70)) : 0)
 		  return 0;
 	 }
-  return (((pthread_mutex_unlock (&(d->lock)) ? IER(199) : 0) ? (d->valid = MUGGLE(71)) : 0) ? 0 : done);
+  return (((_nthm_unlock (&(d->lock)) ? IER(199) : 0) ? (d->valid = MUGGLE(71)) : 0) ? 0 : done);
 }
 
 
@@ -238,28 +460,263 @@ blockers_killed (d, err)
 
 
 int
-_nthm_descendants_killed (d, err)
+_nthm_descendants_killed (d, placeholding, err)
 	  nthm_pipe d;
+	  int placeholding;
 	  int *err;
 
 	  // Kill both the blockers and the finishers to a drain. The pipes
 	  // in the finishers queue are assumed to have had their
 	  // descendants killed already. A lock is needed here in case one
-	  // of the blockers finishes concurrently.
+	  // of the blockers finishes concurrently, but it's let off the
+	  // drain while each finisher is retired, because a finisher's
+	  // thread may still be holding its own lock while it waits for
+	  // the drain's lock to signal its progress. The drain is normally
+	  // a yielding pipe, but may be a placeholder if placeholding is
+	  // requested, as when nthm_scope_run kills what's left in its
+	  // scope.
 {
   nthm_pipe finisher;
   scope_stack e;
   int done;
 
-  if ((! d) ? IER(200) : (d->valid != MAGIC) ? IER(201) : ! blockers_killed (d, err))
+  if ((! d) ? IER(200) : (d->valid != MAGIC) ? IER(201) : ! blockers_killed (d, placeholding, err))
+	 return 0;
+  for (done = 0; ! done;)
+	 {
+		if ((_nthm_lock (&(d->lock)) ? IER(202) : 0) ? (d->valid = MUGGLE(72)) : 0)
+		  return 0;
+		if (((e = d->scope) ? 0 : IER(203)) ? (d->valid = MUGGLE(73)) : ! _nthm_collected (d, err))
+		  finisher = NULL;
+		else
+		  done = ! (finisher = _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err));
+		if ((_nthm_unlock (&(d->lock)) ? IER(205) : 0) ? (d->valid = MUGGLE(74)) : 0)
+		  return 0;
+		if (done ? 0 : (! finisher) ? 1 : finisher->pool ? IER(204) : ! _nthm_retired (finisher, err))
+		  return 0;
+	 }
+  return _nthm_fallen_retired (d, err);
+}
+
+
+
+
+
+
+
+
+
+static int
+released (t, err)
+	  pipe_list *t;
+	  int *err;
+
+	  // Retire the finished sources in a list detached from a drain.
+	  // Each source is locked and unlocked first in case its thread
+	  // hasn't yet let go of the lock after pushing itself onto the
+	  // drain's arrivals.
+{
+  nthm_pipe s;
+
+  while (*t)
+	 {
+		if ((s = _nthm_popped (t, err)) ? (s->valid != MAGIC) : 1)
+		  return ! IER(418);
+		if ((_nthm_lock (&(s->lock)) ? IER(419) : 0) ? (s->valid = MUGGLE(135)) : 0)
+		  return 0;
+		if ((_nthm_unlock (&(s->lock)) ? IER(420) : 0) ? (s->valid = MUGGLE(136)) : 0)
+		  return 0;
+		if (s->pool ? IER(421) : (! _nthm_shutdown_cleared (s->runtime, err)) ? 1 : ! _nthm_retired (s, err))
+		  return 0;
+	 }
+  return 1;
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_fallen_retired (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Retire the cancelled sources that have been collected by a
+	  // drain d. They're detached from the drain all at once so that
+	  // it needn't be locked while they're retired.
+{
+  pipe_list f;
+
+  if ((! d) ? IER(422) : (d->valid != MAGIC) ? IER(423) : 0)
+	 return 0;
+  f = NULL;
+  if ((_nthm_lock (&(d->lock)) ? IER(424) : 0) ? (d->valid = MUGGLE(137)) : 0)
+	 return 0;
+  if (_nthm_collected (d, err) ? (f = d->fallen) : NULL)
+	 f->previous_pipe = &f;
+  d->fallen = NULL;
+  if ((_nthm_unlock (&(d->lock)) ? IER(425) : 0) ? (d->valid = MUGGLE(138)) : 0)
+	 return 0;
+  return released (&f, err);
+}
+
+
+
+
+
+
+
+
+
+static pipe_list
+cancelled (d, e)
+	  nthm_pipe d;
+	  scope_stack e;
+
+	  // Cancel the blockers in a scope e of a locked drain d.
+	  // Incrementing the scope's epoch cancels them all at once,
+	  // because each of them compares it to the epoch it was tethered
+	  // in when it checks whether it's been killed, and when it's
+	  // collected after yielding. The blockers are moved to the
+	  // scope's casualties for the same reason they were in the
+	  // blockers, namely so that they can be untethered and killed if
+	  // the scope is exited before they finish. The casualties list
+	  // usually has nothing left in it from a previous cancellation,
+	  // so it's cheap to find its end. The drain's count of
+	  // cancellations is incremented for the benefit of sources that
+	  // can avoid locking it if the count hasn't changed. The former
+	  // blockers are returned so that any of them that are waiting can
+	  // be woken.
+{
+  pipe_list *c;
+  pipe_list b;
+
+  e->epoch++;
+  __atomic_add_fetch (&(d->cancellations), 1, __ATOMIC_SEQ_CST);
+  for (c = &(e->casualties); *c; c = &((*c)->next_pipe));
+  if ((*c = b = e->blockers))
+	 (*c)->previous_pipe = c;
+  e->blockers = NULL;
+  return b;
+}
+
+
+
+
+
+
+
+
+static int
+woken (d, c, err)
+	  nthm_pipe d;
+	  pipe_list c;
+	  int *err;
+
+	  // Signal the progress of each cancelled source in a list c that's
+	  // waiting for its own sources in a read, select or join, so that
+	  // the wait is interrupted as it would be if the source were
+	  // killed. Sources that aren't waiting are left alone, because
+	  // they'll notice the cancellation before they next wait. The
+	  // list is the casualties of a drain d in the current context,
+	  // which is unlocked so that the sources can be locked, but
+	  // nothing else changes the list or retires the sources in it
+	  // except nthm_shutdown when d is a placeholder, which is kept
+	  // out by holding the root lock.
+{
+  nthm_pipe s;
+  int done;
+
+  if (d->placeholder ? (pthread_mutex_lock (&(d->runtime->root_lock)) ? IER(526) : 0) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(202) : 0) ? (d->valid = MUGGLE(72)) : 0)
+  for (done = 1; done ? ! ! c : 0; c = c->next_pipe)
+	 {
+		if (((s = c->pipe) ? (s->valid != MAGIC) : 1) ? IER(522) : 0)
+		  done = 0;
+		else if (__atomic_load_n (&(s->sleeping), __ATOMIC_SEQ_CST) ? 0 : ! __atomic_load_n (&(s->joining), __ATOMIC_SEQ_CST))
+		  continue;
+		else if ((_nthm_lock (&(s->lock)) ? IER(523) : 0) ? (s->valid = MUGGLE(165)) : 0)
+		  done = 0;
+		else
+		  {
+			 if (_nthm_progress_signal (&(s->lock)) ? IER(524) : 0)
+				s->valid = MUGGLE(166);
+			 if ((_nthm_unlock (&(s->lock)) ? IER(525) : 0) ? (s->valid = MUGGLE(167)) : 0)
+				done = 0;
+		  }
+	 }
+  return (d->placeholder ? ((pthread_mutex_unlock (&(d->runtime->root_lock)) ? IER(527) : 0) ? 0 : done) : done);
+}
+
+
+
+
+
+
+
+
+int
+_nthm_descendants_cancelled (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Cancel all blockers and retire all finishers in the current
+	  // scope of a drain d, and wake any of the cancelled blockers
+	  // that are waiting.
+{
+  scope_stack e;
+  pipe_list b, f, g;
+
+  if ((! d) ? IER(426) : (d->valid != MAGIC) ? IER(427) : 0)
 	 return 0;
-  if (!(((e = d->scope) ? 0 : IER(203)) ? (d->valid = MUGGLE(73)) : (done = 0)))
-	 while (! (done = ! (finisher = _nthm_dequeued (&(e->finishers), &(e->finisher_queue), err))))
-		if (finisher->pool ? IER(204) : ! _nthm_retired (finisher, err))
-		  break;
-  return ((pthread_mutex_unlock (&(d->lock)) ? IER(205) : 0) ? (!(d->valid = MUGGLE(74))) : done);
+  b = f = g = NULL;
+  if ((_nthm_lock (&(d->lock)) ? IER(428) : 0) ? (d->valid = MUGGLE(139)) : 0)
+	 return 0;
+  if ((((e = d->scope) ? 0 : IER(429)) ? (d->valid = MUGGLE(140)) : 0) ? 0 : _nthm_collected (d, err))
+	 {
+		b = cancelled (d, e);
+		if ((f = e->finishers))
+		  f->previous_pipe = &f;
+		if ((g = d->fallen))
+		  g->previous_pipe = &g;
+		e->finishers = e->finisher_queue = d->fallen = NULL;
+	 }
+  if ((_nthm_unlock (&(d->lock)) ? IER(430) : 0) ? (d->valid = MUGGLE(141)) : (d->valid != MAGIC))
+	 return 0;
+  return (woken (d, b, err) ? released (&f, err) ? released (&g, err) : 0 : 0);
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_scopes_cancelled (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Cancel the blockers in every scope of a locked drain d. Those
+	  // that have already yielded are collected first so that their
+	  // results aren't lost. Finishers are left alone because the
+	  // drain may still read them.
+{
+  uintptr_t l;
+
+  if ((! d) ? IER(437) : (d->valid != MAGIC) ? IER(438) : ! _nthm_collected (d, err))
+	 return 0;
+  if (d->scopes)
+	 for (l = 0; l <= d->level; l++)
+		if (d->scopes[l].blockers)
+		  cancelled (d, d->scopes + l);
+  return 1;
 }
 
 
@@ -281,5 +738,5 @@ _nthm_acknowledged (s, err)
   if ((! s) ? IER(206) : (s->valid != MAGIC) ? IER(207) : 0)
 	 return 0;
   *err = (*err ? *err : s->status);
-  return (_nthm_descendants_killed (s, err) ? _nthm_retired (s, err) : 0);
+  return (_nthm_descendants_killed (s, 0, err) ? _nthm_retired (s, err) : 0);
 }
@@ -30,6 +30,18 @@ _nthm_tethered (nthm_pipe s, nthm_pipe d, int *err);
 extern int
 _nthm_untethered (nthm_pipe s, int *err);
 
+// move the sources that have yielded to a locked drain d into its finishers
+extern int
+_nthm_collected (nthm_pipe d, int *err);
+
+// collect arrivals to a locked drain d and wait for progress if there are none, polling first if requested
+extern int
+_nthm_awaited (nthm_pipe d, unsigned long polls, int *err);
+
+// wait for all sources in the current scope of a locked drain d to yield, being woken only once
+extern int
+_nthm_joined (nthm_pipe d, int *err);
+
 // untether all blockers and finishers under a pipe p
 extern int
 _nthm_descendants_untethered (nthm_pipe p, int *err);
@@ -38,9 +50,21 @@ _nthm_descendants_untethered (nthm_pipe p, int *err);
 extern int
 _nthm_killable (nthm_pipe s, int *err);
 
-// kill both the blockers and the finishers to a drain
+// kill both the blockers and the finishers to a drain, which may be a placeholder only if placeholding
+extern int
+_nthm_descendants_killed (nthm_pipe d, int placeholding, int *err);
+
+// cancel the blockers and retire the finishers in the current scope of a drain
+extern int
+_nthm_descendants_cancelled (nthm_pipe d, int *err);
+
+// cancel the blockers in every scope of a locked drain
+extern int
+_nthm_scopes_cancelled (nthm_pipe d, int *err);
+
+// retire the cancelled sources collected by a drain
 extern int
-_nthm_descendants_killed (nthm_pipe d, int *err);
+_nthm_fallen_retired (nthm_pipe d, int *err);
 
 // retire an untethered unpooled pipe taking note of its error status
 extern int
@@ -27,12 +27,8 @@
 #include "pipes.h"
 #include "protocol.h"
 #include "plumbing.h"
+#include "runtime.h"
 
-// list of untethered and top pipes to be freed on exit
-static pipe_list root_pipes = NULL;
-
-// enforces mutually exclusive access to the root pipe list
-static pthread_mutex_t root_lock;
 
 
 
@@ -43,23 +39,24 @@ static pthread_mutex_t root_lock;
 
 
 int
-_nthm_open_pool (err)
+_nthm_open_pool (r, err)
+	  nthm_runtime r;
 	  int *err;
 
-    // Initialize static storage.
+    // Initialize the root pool of a runtime.
 {
   pthread_mutexattr_t a;
 
   if (! _nthm_error_checking_mutex_type (&a, err))
 	 return 0;
-  if (pthread_mutex_init (&root_lock, &a) ? IER(208) : 0)
+  if (pthread_mutex_init (&(r->root_lock), &a) ? IER(208) : 0)
 	 {
 		pthread_mutexattr_destroy (&a);
 		return 0;
 	 }
   if (!(pthread_mutexattr_destroy (&a) ? IER(209) : 0))
 	 return 1;
-  pthread_mutex_destroy (&root_lock);
+  pthread_mutex_destroy (&(r->root_lock));
   return 0;
 }
 
@@ -70,41 +67,212 @@ _nthm_open_pool (err)
 
 
 
+static int
+waiters_listed (p, w, err)
+	  nthm_pipe p;
+	  pipe_list *w;
+	  int *err;
+
+	  // Push each casualty in every scope of a locked placeholder p
+	  // that's waiting in a read, select or join onto a new list w,
+	  // so that they can be woken after the placeholder is unlocked.
+	  // The placeholder has to be unlocked first because sources are
+	  // locked before drains. Those that aren't waiting yet will
+	  // notice their cancellation before they wait.
+{
+  pipe_list c, t;
+  uintptr_t l;
+  nthm_pipe s;
+
+  if (p->scopes)
+	 for (l = 0; l <= p->level; l++)
+		for (c = p->scopes[l].casualties; c; c = c->next_pipe)
+		  {
+			 if ((s = c->pipe) ? 0 : IER(528))
+				return 0;
+			 if (__atomic_load_n (&(s->sleeping), __ATOMIC_SEQ_CST) ? 0 : ! __atomic_load_n (&(s->joining), __ATOMIC_SEQ_CST))
+				continue;
+			 if (! (t = _nthm_pipe_list_of (s, err)))
+				return 0;
+			 if (! _nthm_pushed (t, w, err))
+				return (_nthm_freed (t, err) ? 0 : ! IER(529));
+		  }
+  return 1;
+}
+
+
+
+
+
+
+
+
+static int
+listed_woken (w, err)
+	  pipe_list *w;
+	  int *err;
+
+	  // Signal the progress of each source in a list w of cancelled
+	  // blockers of a placeholder so that they're interrupted as if
+	  // killed. The root lock is held throughout, which keeps them
+	  // from being retired in the meantime even if they yield and are
+	  // collected by the placeholder's thread, because a thread
+	  // retiring its fallen sources waits for the root lock first
+	  // once the runtime is shutting down. The list is consumed even
+	  // if something goes wrong.
+{
+  nthm_pipe s;
+  int done;
+
+  for (done = 1; *w;)
+	 {
+		if (((s = _nthm_popped (w, err)) ? (s->valid != MAGIC) : 1) ? IER(530) : 0)
+		  done = 0;
+		if ((! done) ? 1 : (_nthm_lock (&(s->lock)) ? IER(531) : 0) ? (s->valid = MUGGLE(168)) : 0)
+		  continue;
+		if (_nthm_progress_signal (&(s->lock)) ? IER(532) : 0)
+		  done = ! (s->valid = MUGGLE(169));
+		if ((_nthm_unlock (&(s->lock)) ? IER(533) : 0) ? (s->valid = MUGGLE(170)) : 0)
+		  done = 0;
+	 }
+  return done;
+}
+
+
+
+
+
+
+
+
+static int
+killed_up_front (p, cancelling, err)
+	  nthm_pipe p;
+	  int cancelling;
+	  int *err;
+
+	  // Kill a running root pipe and wake it in case it's waiting, so
+	  // that all of them wind down together rather than each only when
+	  // the previous one has been reclaimed. Placeholders pertain to
+	  // unmanaged threads, so they're left alone unless cancelling, in
+	  // which case their blockers in every scope are cancelled instead
+	  // and any of them that are waiting are woken. The root lock is
+	  // held by the caller.
+{
+  pipe_list w;
+  int done;
+
+  if ((! p) ? IER(432) : (p->valid != MAGIC) ? IER(433) : 0)
+	 return 0;
+  if ((_nthm_lock (&(p->lock)) ? IER(434) : 0) ? (p->valid = MUGGLE(143)) : 0)
+	 return 0;
+  w = NULL;
+  done = 1;
+  if (p->placeholder ? (cancelling ? ! _nthm_scopes_cancelled (p, err) : 0) : 0)
+	 p->valid = MUGGLE(146);
+  else if (p->placeholder ? (cancelling ? ! waiters_listed (p, &w, err) : 0) : 0)
+	 done = 0;
+  else if ((p->placeholder ? 0 : p->yielded ? 0 : p->killed ? 0 : (p->killed = 1)) ? (_nthm_progress_signal (&(p->lock)) ? IER(435) : 0) : 0)
+	 p->valid = MUGGLE(144);
+  done = ((p->valid == MAGIC) ? done : 0);
+  if ((_nthm_unlock (&(p->lock)) ? IER(436) : 0) ? (p->valid = MUGGLE(145)) : 0)
+	 done = 0;
+  return (listed_woken (&w, err) ? done : 0);
+}
+
+
+
+
+
+
+
+
+static int
+truncated_throughout (p, err)
+	  nthm_pipe p;
+	  int *err;
+
+	  // Truncate every scope of a root pipe, which also truncates all
+	  // of its descendants because they check their drains' scopes
+	  // when polling for truncation. Truncation levels saturate as
+	  // they do in nthm_truncate.
+{
+  uintptr_t l;
+  unsigned t;
+
+  if ((! p) ? IER(439) : (p->valid != MAGIC) ? IER(440) : 0)
+	 return 0;
+  if ((_nthm_lock (&(p->lock)) ? IER(441) : 0) ? (p->valid = MUGGLE(147)) : 0)
+	 return 0;
+  if (p->scopes)
+	 for (l = 0; l <= p->level; l++)
+		if ((t = p->scopes[l].truncation + 1))
+		  p->scopes[l].truncation = t;
+  return ! ((_nthm_unlock (&(p->lock)) ? IER(442) : 0) ? (p->valid = MUGGLE(148)) : 0);
+}
+
+
+
+
+
+
+
+
 static void
-eradicate (err)
+eradicate (r, err)
+	  nthm_runtime r;
 	  int *err;
 
-	  // Reclaim the root pipes.
+	  // Reclaim the root pipes of a runtime r. Untethered pipes whose
+	  // results were never read are killed so that they can be
+	  // retired, which passes their results to their destructors, if
+	  // any. Those that are still running are all killed before any
+	  // of them is waited for. The placeholder of the exiting thread
+	  // has its descendants untethered into the root pool, where
+	  // they're killed in the same way, because nothing will ever read
+	  // them now.
 {
-  nthm_pipe p;
-  pipe_list q;
+  nthm_pipe c, p;
+  pipe_list q, t;
   void *leak;
   int k;
 
   p = NULL;
+  c = _nthm_current_context ();
   while (! *err)
 	 {
-		if (pthread_mutex_lock (&root_lock) ? IER(210) : 0)
+		if (pthread_mutex_lock (&(r->root_lock)) ? IER(210) : 0)
 		  return;
-		if (((q = root_pipes)) ? (q->previous_pipe = &q) : NULL)
-		  root_pipes = NULL;
-		if (pthread_mutex_unlock (&root_lock) ? IER(211) : ! q)
+		if (((q = r->root_pipes)) ? (q->previous_pipe = &q) : NULL)
+		  r->root_pipes = NULL;
+		if (pthread_mutex_unlock (&(r->root_lock)) ? IER(211) : ! q)
 		  return;
+		for (t = q; t; t = t->next_pipe)
+		  if (! killed_up_front (t->pipe, 0, err))
+			 return;
 		while (*err ? NULL : (p = (q ? _nthm_popped (&q, err) : NULL)))
 		  {
 			 _nthm_vacate_scopes (p, err);
 			 if ((p->valid != MAGIC) ? IER(212) : p->reader ? IER(213) : p->pool ? (! ! (p->pool = NULL)) : IER(214))
 				return;
+			 if ((p == c) ? ! _nthm_descendants_untethered (p, err) : 0)
+				return;
 			 if (_nthm_retirable (p, err) ? (_nthm_retired (p, err) ? 1 : IER(215)) : 0)
-				continue;
-			 if ((pthread_mutex_lock (&(p->lock)) ? IER(216) : 0) ? (p->valid = MUGGLE(75)) : 0)
+				{
+				  if (p == c)
+					 _nthm_clear_context (err);
+				  continue;
+				}
+			 if ((_nthm_lock (&(p->lock)) ? IER(216) : 0) ? (p->valid = MUGGLE(75)) : 0)
 				return;
-			 k = (p->placeholder ? (p->killed ? 1 : (p->killed)++) : 0);
-			 if ((pthread_mutex_unlock (&(p->lock)) ? IER(217) : 0) ? (p->valid = MUGGLE(76)) : 0)
+			 if (p->placeholder ? 0 : p->yielded)
+				p->killed = 1;          // discard an unread result so that the pipe can be retired
+			 k = (p->placeholder ? (p->killed ? 1 : (p->killed)++) : ! (p->yielded));
+			 if ((_nthm_unlock (&(p->lock)) ? IER(217) : 0) ? (p->valid = MUGGLE(76)) : 0)
 				return;
 			 if (k ? 0 : _nthm_pooled (p, err) ? 1 : IER(218))
 				continue;
-			 if ((leak = _nthm_untethered_read (p, err)))
+			 if ((leak = _nthm_untethered_read (p, 0UL, err)))
 				IER(219);
 		  }
 	 }
@@ -116,18 +284,17 @@ eradicate (err)
 
 
 void
-_nthm_close_pool ()
+_nthm_close_pool (r, err)
+	  nthm_runtime r;
+	  int *err;
 
-	  // Safely free the root pipes and other static storage. This
-	  // operation executes during the exit phase but multiple threads
-	  // might still be running.
+	  // Safely free the root pipes of a runtime. This operation
+	  // executes during the exit phase or when the runtime is freed,
+	  // but multiple threads might still be running.
 {
-  int err;
-
-  err = 0;
-  eradicate (&err);
-  _nthm_globally_throw (err);
-  _nthm_globally_throw (pthread_mutex_destroy (&root_lock) ? THE_IER(220) : 0);
+  eradicate (r, err);
+  if (pthread_mutex_destroy (&(r->root_lock)))
+	 IER(220);
 }
 
 
@@ -174,19 +341,72 @@ _nthm_placed (d, err)
   done = 0;
   if ((! d) ? IER(221) : (d->valid != MAGIC) ? IER(222) : 0)
 	 return 0;
-  if (pthread_mutex_lock (&root_lock) ? IER(223) : (done = 0))
+  if (pthread_mutex_lock (&(d->runtime->root_lock)) ? IER(223) : (done = 0))
 	 return 0;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(224) : 0) ? (d->valid = MUGGLE(77)) : 0)
+  if ((_nthm_lock (&(d->lock)) ? IER(224) : 0) ? (d->valid = MUGGLE(77)) : 0)
 	 goto a;
   if (d->pool ? (done = 1) : ! (d->pool = _nthm_pipe_list_of (d, err)))
 	 goto b;
-  if ((done = _nthm_pushed (d->pool, &root_pipes, err)))
+  if ((done = _nthm_pushed (d->pool, &(d->runtime->root_pipes), err)))
 	 goto b;
   if (_nthm_freed (d->pool, err) ? (! ! (d->pool = NULL)) : 1)
 	 IER(225);
- b: if (pthread_mutex_unlock (&(d->lock)) ? IER(226) : 0)
+ b: if (_nthm_unlock (&(d->lock)) ? IER(226) : 0)
 	 d->valid = MUGGLE(78);
- a: return ((pthread_mutex_unlock (&root_lock) ? IER(227) : 0) ? 0 : done);
+ a: return ((pthread_mutex_unlock (&(d->runtime->root_lock)) ? IER(227) : 0) ? 0 : done);
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_relocated (r, t, blocking, killing, err)
+	  nthm_runtime r;
+	  pipe_list *t;
+	  int blocking;
+	  int killing;
+	  int *err;
+
+	  // Untether the sources in a list t that's been detached from the
+	  // scope of a drain and insert them into the root pool of its
+	  // runtime r, with the root lock acquired only once for all of them
+	  // rather than once for each. Each source is locked while its
+	  // reader is freed so that it can't yield concurrently. If t held
+	  // the drain's blockers, any of them that have yielded since the
+	  // drain last collected its arrivals are still in the arrivals, so
+	  // they're left in the list for the drain to collect. If killing is
+	  // requested, the sources are also killed and woken in case they're
+	  // waiting.
+{
+  nthm_pipe s;
+  int done;
+
+  if ((! t) ? IER(395) : pthread_mutex_lock (&(r->root_lock)) ? IER(396) : 0)
+	 return 0;
+  for (done = 1; done ? ! ! *t : 0;)
+	 {
+		if (((s = (*t)->pipe) ? (s->valid != MAGIC) : 1) ? IER(397) : (_nthm_lock (&(s->lock)) ? IER(398) : 0) ? (s->valid = MUGGLE(124)) : 0)
+		  {
+			 done = 0;
+			 break;
+		  }
+		if (blocking ? s->yielded : 0)
+		  t = &((*t)->next_pipe);
+		else if ((_nthm_popped (t, err) != s) ? IER(399) : s->pool ? IER(400) : ! (s->pool = _nthm_pipe_list_of (s, err)))
+		  done = 0;
+		else if ((done = _nthm_pushed (s->pool, &(r->root_pipes), err)) ? 0 : _nthm_freed (s->pool, err) ? (! ! (s->pool = NULL)) : 1)
+		  IER(401);
+		if ((killing ? (done ? s->pool : NULL) : NULL) ? ((s->killed = 1) ? (_nthm_progress_signal (&(s->lock)) ? IER(431) : 0) : 0) : 0)
+		  done = ! (s->valid = MUGGLE(142));
+		if ((_nthm_unlock (&(s->lock)) ? IER(402) : 0) ? (s->valid = MUGGLE(125)) : 0)
+		  done = 0;
+	 }
+  return ((pthread_mutex_unlock (&(r->root_lock)) ? IER(403) : 0) ? 0 : done);
 }
 
 
@@ -206,15 +426,15 @@ _nthm_displace (p, err)
 {
   if ((! p) ? IER(228) : (p->valid != MAGIC) ? IER(229) : 0)
 	 return;
-  if (pthread_mutex_lock (&root_lock) ? IER(230) : 0)
+  if (pthread_mutex_lock (&(p->runtime->root_lock)) ? IER(230) : 0)
 	 return;
-  if ((pthread_mutex_lock (&(p->lock)) ? IER(231) : 0) ? (p->valid = MUGGLE(79)) : 0)
+  if ((_nthm_lock (&(p->lock)) ? IER(231) : 0) ? (p->valid = MUGGLE(79)) : 0)
 	 goto a;
   if (p->pool ? _nthm_unilaterally_delisted (&(p->pool), err) : 0)
 	 p->pool = NULL;
-  if (pthread_mutex_unlock (&(p->lock)) ? IER(232) : 0)
+  if (_nthm_unlock (&(p->lock)) ? IER(232) : 0)
 	 p->valid = MUGGLE(80);
-  a: if (pthread_mutex_unlock (&root_lock))
+  a: if (pthread_mutex_unlock (&(p->runtime->root_lock)))
 	 IER(233);
 }
 
@@ -231,14 +451,93 @@ _nthm_unpool (p, err)
 	  int *err;
 
 	  // If a pipe is retirable, retire it and take it out of the root
-	  // pool.
+	  // pool. A placeholder holding storage allocated at its top level
+	  // by nthm_scope_alloc is kept until exit so that the storage
+	  // stays valid.
 {
   int c;   // non-zero if the pipe is a placeholder for the current context
 
-  if ((! p) ? IER(234) : (p->valid != MAGIC) ? IER(235) : ! _nthm_retirable (p, err))
+  if ((! p) ? IER(234) : (p->valid != MAGIC) ? IER(235) : (p->placeholder ? (p->scope ? ! ! (p->scope->arena) : 0) : 0) ? 1 : ! _nthm_retirable (p, err))
 	 return;
   c = (p->placeholder ? (_nthm_current_context () == p) : 0);
   _nthm_displace (p, err);
   if (_nthm_retired (p, err) ? c : ! IER(236))
 	 _nthm_clear_context (err);
 }
+
+
+
+
+
+
+
+
+int
+_nthm_pool_truncated (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Truncate every scope of every root pipe.
+{
+  pipe_list q;
+  int done;
+
+  if (pthread_mutex_lock (&(r->root_lock)) ? IER(443) : 0)
+	 return 0;
+  for (done = 1, q = r->root_pipes; done ? ! ! q : 0; q = q->next_pipe)
+	 done = truncated_throughout (q->pipe, err);
+  return ((pthread_mutex_unlock (&(r->root_lock)) ? IER(444) : 0) ? 0 : done);
+}
+
+
+
+
+
+
+
+
+int
+_nthm_pool_killed (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Kill every running root pipe, and cancel and wake the blockers
+	  // of every placeholder. The rest of the tree is killed as each of these
+	  // yields.
+{
+  pipe_list q;
+  int done;
+
+  if (pthread_mutex_lock (&(r->root_lock)) ? IER(445) : 0)
+	 return 0;
+  for (done = 1, q = r->root_pipes; done ? ! ! q : 0; q = q->next_pipe)
+	 done = killed_up_front (q->pipe, 1, err);
+  return ((pthread_mutex_unlock (&(r->root_lock)) ? IER(446) : 0) ? 0 : done);
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_shutdown_cleared (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Wait for the root lock of a runtime r if it's shutting down,
+	  // because it's held while the blockers of placeholders are
+	  // woken, and none of them can be retired until that's done.
+	  // A thread calls this before retiring sources it's collected.
+	  // Until the runtime shuts down, none of its sources can be
+	  // among those being woken.
+{
+  if (! __atomic_load_n (&(r->shut_down), __ATOMIC_ACQUIRE))
+	 return 1;
+  if (pthread_mutex_lock (&(r->root_lock)) ? IER(534) : 0)
+	 return 0;
+  return ! (pthread_mutex_unlock (&(r->root_lock)) ? IER(535) : 0);
+}
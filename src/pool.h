@@ -18,6 +18,7 @@
 */
 
 #include <nthm.h>
+#include "pipl.h"
 
 // non-API operations for managing a pool of root pipes corresponding
 // to untethered and unmanaged threads
@@ -30,6 +31,10 @@ _nthm_pooled (nthm_pipe d, int *err);
 extern int
 _nthm_placed (nthm_pipe d, int *err);
 
+// untether the sources in a list detached from a drain and insert them into the root pool together, maybe killing them
+extern int
+_nthm_relocated (nthm_runtime r, pipe_list *t, int blocking, int killing, int *err);
+
 // if a pipe is retirable, take it out of the root pool retire it
 extern void
 _nthm_unpool (nthm_pipe p, int *err);
@@ -38,10 +43,22 @@ _nthm_unpool (nthm_pipe p, int *err);
 extern void
 _nthm_displace (nthm_pipe p, int * err);
 
-// initialize static storage
+// truncate every scope of every root pipe in a runtime
+extern int
+_nthm_pool_truncated (nthm_runtime r, int *err);
+
+// kill every running root pipe and cancel and wake the blockers of every placeholder in a runtime
+extern int
+_nthm_pool_killed (nthm_runtime r, int *err);
+
+// wait until a runtime that's shutting down has finished waking the blockers of placeholders
+extern int
+_nthm_shutdown_cleared (nthm_runtime r, int *err);
+
+// initialize the root pool of a runtime
 extern int
-_nthm_open_pool (int *err);
+_nthm_open_pool (nthm_runtime r, int *err);
 
-// free the root pipes and other static storage
+// free the root pipes of a runtime
 extern void
-_nthm_close_pool (void);
+_nthm_close_pool (nthm_runtime r, int *err);
@@ -20,11 +20,14 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <pthread.h>
 #include "protocol.h"
 #include "plumbing.h"
 #include "pipes.h"
 #include "sync.h"
+#include "runtime.h"
+#include "stock.h"
 #include "context.h"
 #include "errs.h"
 
@@ -38,33 +41,83 @@ static int deadlocked = 0;
 
 
 
+static void
+handed_over (arena, err)
+	  chunk arena;
+	  int *err;
+
+	  // Pass the arena detached from a pipe whose result has just been
+	  // read to the current scope of the reading thread, so that
+	  // storage allocated for the result outlives the pipe. A thread
+	  // with no pipe of its own gets a placeholder to hold it, which
+	  // is kept until exit. This is done before the pipe is
+	  // untethered, because that may retire the reader's placeholder.
+{
+  if (arena)
+	 _nthm_arena_adopted (_nthm_current_or_new_context (err), arena, err);
+}
+
+
+
+
 void *
-_nthm_untethered_read (s, err)
+_nthm_untethered_read (s, polls, err)
 	  nthm_pipe s;
+	  unsigned long polls;
 	  int *err;
 
 	  // Read from a pipe with no designated drain and therefore no
 	  // opportunity for the read to be interrupted by the drain being
-	  // killed. Wait on the pipe's termination signal if necessary.
+	  // killed. If it hasn't yielded because it's still waiting for a
+	  // thread, run it in this one. Otherwise poll its yielded flag up
+	  // to the given number of times with the lock let off, and then
+	  // wait on the pipe's termination signal if necessary.
 {
+  unsigned long i;
   void *result;
+  chunk arena;
+  int w;
 
   result = NULL;
+  arena = NULL;
   if ((! s) ? IER(237) : (s->valid != MAGIC) ? IER(238) : 0)
 	 return NULL;
-  if ((pthread_mutex_lock (&(s->lock)) ? IER(239) : 0) ? (s->valid = MUGGLE(81)) : 0)
+  if ((_nthm_lock (&(s->lock)) ? IER(239) : 0) ? (s->valid = MUGGLE(81)) : 0)
 	 return NULL;
   if (s->reader ? (*err = (*err ? *err : NTHM_NOTDRN)) : 0)
 	 goto a;
-  if (s->yielded ? 0 : (pthread_cond_wait (&(s->termination), &(s->lock)) ? IER(240) : 0) ? (s->valid = MUGGLE(82)) : 0)
-	 goto a;
+  if (s->yielded ? 1 : ! __atomic_load_n (&(s->runtime->queue), __ATOMIC_RELAXED))
+	 goto b;
+  if ((_nthm_unlock (&(s->lock)) ? IER(508) : 0) ? (s->valid = MUGGLE(154)) : 0)
+	 return NULL;
+  if (_nthm_claimed (s, err))
+	 _nthm_inlined (s, err);
+  if ((_nthm_lock (&(s->lock)) ? IER(509) : 0) ? (s->valid = MUGGLE(155)) : 0)
+	 return NULL;
+ b: if ((w = ! (s->yielded)) ? polls : 0)
+	 {
+		if ((_nthm_unlock (&(s->lock)) ? IER(372) : 0) ? (s->valid = MUGGLE(113)) : 0)
+		  return NULL;
+		for (i = 0; (i < polls) ? ! __atomic_load_n (&(s->yielded), __ATOMIC_ACQUIRE) : 0; i++)
+		  PAUSE ();
+		if ((_nthm_lock (&(s->lock)) ? IER(373) : 0) ? (s->valid = MUGGLE(114)) : 0)
+		  return NULL;
+	 }
+  if (w)
+	 _nthm_wait_counted (&(s->runtime->tally), ! ! polls, polls ? s->yielded : 0);
+  while (! (s->yielded))
+	 if ((_nthm_termination_wait (&(s->lock)) ? IER(240) : 0) ? (s->valid = MUGGLE(82)) : 0)
+		goto a;
   result = s->result;
+  s->result = NULL;
+  arena = (s->killed ? NULL : _nthm_arena_detached (s, err));
   if (*err ? 0 : s->status ? (*err = s->status) : 0)
 	 s->status = 0;
  a: if (s->yielded ? 0 : (s->yielded = 1))
 	 IER(241);
-  if (pthread_mutex_unlock (&(s->lock)) ? IER(242) : 0)
+  if (_nthm_unlock (&(s->lock)) ? IER(242) : 0)
 	 s->valid = MUGGLE(83);
+  handed_over (arena, err);
   return (_nthm_killable (s, err) ? result : NULL);
 }
 
@@ -80,39 +133,51 @@ _nthm_untethered_read (s, err)
 
 
 void *
-_nthm_tethered_read (s, err)
+_nthm_tethered_read (s, polls, err)
 	  nthm_pipe s;
+	  unsigned long polls;
 	  int *err;
 
 	  // Read from a source s whose drain d is running in the current
-	  // context, unless the drain is killed. The source knows it has a
-	  // drain and so will signal the drain's progress rather than its
-	  // own termination signal when it terminates. If the drain has
-	  // other sources than the one it's trying to read, one of the
-	  // others might signal it first and it may have to continue
-	  // waiting, hence the loop.
+	  // context, unless the drain is killed or cancelled. The source
+	  // knows it has a drain and so will signal the drain's progress
+	  // rather than its own termination signal when it terminates. If
+	  // the drain has other sources than the one it's trying to read,
+	  // one of the others might signal it first and it may have to
+	  // continue waiting, hence the loop. The source sets its yielded
+	  // flag without locking the drain, so the flag is read
+	  // atomically. The drain polls up to the given number of times
+	  // before each wait. A source still waiting for a thread is run
+	  // in this one first.
 {
   nthm_pipe d;
   void *result;
-  int done;
+  chunk arena;
+  int yielded, done;
 
   result = NULL;
+  arena = NULL;
   if ((! s) ? IER(243) : (s->valid != MAGIC) ? IER(244) : s->reader ? 0 : IER(245))
 	 return NULL;
   if (_nthm_drained_by (s, d = _nthm_current_context (), err) ? 0 : (*err = (*err ? *err : NTHM_NOTDRN)))
 	 return NULL;
   if (((! d) ? IER(246) : (d->valid != MAGIC) ? IER(247) : 0) ? (s->valid = MUGGLE(84)) : 0)
 	 return NULL;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(248) : 0) ? (d->valid = MUGGLE(85)) : 0)
+  if (_nthm_claimed (s, err))
+	 _nthm_inlined (s, err);
+  if ((_nthm_lock (&(d->lock)) ? IER(248) : 0) ? (d->valid = MUGGLE(85)) : 0)
 	 return NULL;
-  while (! (done = (s->yielded ? 1 : d->killed)))
-	 if (pthread_cond_wait (&(d->progress), &(d->lock)) ? IER(249) : 0)
+  while (! (done = ((yielded = __atomic_load_n (&(s->yielded), __ATOMIC_ACQUIRE)) ? 1 : _nthm_killed_or_cancelled (d, err))))
+	 if (! _nthm_awaited (d, polls, err))
 		goto a;
   if (*err ? 0 : s->status ? (*err = s->status) : 0)
 	 s->status = 0;
-  result = (s->yielded ? s->result : NULL);
- a: if (pthread_mutex_unlock (&(d->lock)) ? IER(250) : 0)
+  if ((result = (yielded ? s->result : NULL)))
+	 s->result = NULL;
+  arena = (yielded ? _nthm_arena_detached (s, err) : NULL);
+ a: if (_nthm_unlock (&(d->lock)) ? IER(250) : 0)
 	 d->valid = MUGGLE(86);
+  handed_over (arena, err);
   return ((done ? _nthm_killable (s, err) : 0) ? result : NULL);
 }
 
@@ -123,6 +188,55 @@ _nthm_tethered_read (s, err)
 
 
 
+
+void *
+_nthm_finished_read (s, done, err)
+	  nthm_pipe s;
+	  int *done;
+	  int *err;
+
+	  // Read from a source that has already yielded and is either
+	  // untethered or drained by the current context, and set *done.
+	  // This is the usual case for a pipe returned by nthm_select,
+	  // which can be read and retired without being tethered again
+	  // and without locking the drain. If the source hasn't yielded
+	  // or belongs to some other drain, it's left alone and *done is
+	  // cleared so that the caller can follow one of the protocols
+	  // above. The yielded flag is monotonic, so it can be checked
+	  // before locking the source.
+{
+  void *result;
+  chunk arena;
+
+  result = NULL;
+  arena = NULL;
+  if ((! done) ? IER(374) : (*done = 0))
+	 return NULL;
+  if ((! s) ? IER(375) : (s->valid != MAGIC) ? IER(376) : ! __atomic_load_n (&(s->yielded), __ATOMIC_ACQUIRE))
+	 return NULL;
+  if ((_nthm_lock (&(s->lock)) ? IER(377) : 0) ? (s->valid = MUGGLE(115)) : 0)
+	 return NULL;
+  if (s->reader ? (! _nthm_drained_by (s, _nthm_current_context (), err)) : 0)
+	 goto a;
+  *done = 1;
+  result = s->result;
+  s->result = NULL;
+  arena = (s->killed ? NULL : _nthm_arena_detached (s, err));
+  if (*err ? 0 : s->status ? (*err = s->status) : 0)
+	 s->status = 0;
+ a: if (_nthm_unlock (&(s->lock)) ? IER(378) : 0)
+	 s->valid = MUGGLE(116);
+  handed_over (arena, err);
+  return ((*done ? _nthm_killable (s, err) : 0) ? result : NULL);
+}
+
+
+
+
+
+
+
+
 // --------------- source-side protocol --------------------------------------------------------------------
 
 
@@ -132,6 +246,36 @@ _nthm_tethered_read (s, err)
 
 
 
+static void
+notified (notifier, context, err)
+	  nthm_notifier notifier;
+	  void *context;
+	  int *err;
+
+	  // Call a notifier taken from a pipe that has just yielded, or
+	  // from its drain, with no pipe identified with the current
+	  // thread while it runs. The notifier typically resumes code that
+	  // was waiting for the pipe, and that code shouldn't be mistaken
+	  // for the pipe's own. The pipe may already be retired, so it
+	  // isn't referenced.
+{
+  nthm_pipe c;
+
+  if (! notifier)
+	 return;
+  c = _nthm_current_context ();
+  _nthm_clear_context (err);
+  (notifier) (context);
+  _nthm_set_context (c, err);
+}
+
+
+
+
+
+
+
+
 static void
 untethered_yield (s, err)
 	  nthm_pipe s;
@@ -141,17 +285,28 @@ untethered_yield (s, err)
 	  // setting their yielded flag and signaling their termination
 	  // condition. The pipe is assumed to be locked on entry to this
 	  // function and is unlocked on exit. If the thread is already
-	  // killed at this point the pipe will be retired when pooled.
+	  // killed at this point the pipe will be retired when pooled, but
+	  // its result will never be read, so it's passed to the
+	  // destructor right away rather than waiting for the pipe to be
+	  // retired, and without holding the lock.
 {
+  nthm_destructor destructor;
+  void *result;
+
   if ((! s) ? IER(251) : (s->valid != MAGIC) ? IER(252) : 0)
 	 return;
-  s->yielded = 1;
-  if (pthread_cond_signal (&(s->termination)) ? IER(253) : 0)
+  destructor = s->destructor;
+  if ((result = (s->killed ? s->result : NULL)))
+	 s->result = NULL;
+  __atomic_store_n (&(s->yielded), 1, __ATOMIC_RELEASE);
+  if (_nthm_termination_signal (&(s->lock)) ? IER(253) : 0)
 	 s->valid = MUGGLE(87);
   else if (s->killed ? 0 : s->status ? 0 : (s->status = *err))
 	 *err = 0;
-  if (pthread_mutex_unlock (&(s->lock)) ? IER(254) : 0)
+  if (_nthm_unlock (&(s->lock)) ? IER(254) : 0)
 	 s->valid = MUGGLE(88);
+  if (result ? destructor : NULL)
+	 (destructor) (result);
 }
 
 
@@ -166,43 +321,61 @@ tethered_yield (s, err)
 	  nthm_pipe s;
 	  int *err;
 
-	  // Pipes that have a drain d indicate termination by atomically
-	  // setting their yielded flag, moving themselves from the drain's
-	  // blocker list to its finishers queue, and signaling the drain's
-	  // progress condition. The source s is assumed to be locked on
-	  // entry.
+	  // Pipes that have a drain d indicate termination by setting
+	  // their yielded flag, pushing themselves onto the drain's
+	  // arrivals without locking the drain, and signaling the drain's
+	  // progress condition. The drain moves them from its blockers to
+	  // its finishers when it collects its arrivals. Only a source
+	  // arriving first since the last collection to a sleeping drain
+	  // has to lock the drain to signal it, because the drain checks
+	  // for arrivals before sleeping. If the drain is joining the
+	  // source's scope, the source counts itself off instead and
+	  // signals only if it's the last. The source s is assumed to be
+	  // locked on entry and stays locked until the signal is sent, so
+	  // that the drain can't retire it sooner. A drain with a herald
+	  // set by nthm_notify_select is locked by any arriving source so
+	  // that the first one from the heralded scope can take it and
+	  // call it after letting go of both locks.
 {
-  scope_stack e;
-  pipe_list b;    // the entry in the drain's blocker list corresponding to the source
-  nthm_pipe d;    // drain
-  uintptr_t l;    // scope level
-
+  nthm_notifier h; // the drain's herald, if taken
+  void *k;         // the herald's context
+  nthm_pipe a;     // the previous arrival
+  nthm_pipe d;     // drain
+  int last;        // set if the source is the last one a joining drain is waiting for
+  int woken;       // set if the drain has to be signaled
+
+  h = NULL;
+  k = NULL;
   if ((! s) ? IER(255) : (s->valid != MAGIC) ? IER(256) : s->killed ? IER(257) : 0)
 	 return;
   if ((!(s->reader)) ? IER(258) : (!(d = s->reader->pipe)) ? IER(259) : (d->valid != MAGIC) ? IER(260) : 0)
 	 goto a;
-  if ((pthread_mutex_lock (&(d->lock)) ? IER(261) : 0) ? (d->valid = MUGGLE(89)) : 0)
-	 goto a;
-  if (((e = d->scope) ? 0 : IER(262)) ? (d->valid = MUGGLE(90)) : 0)
-	 goto b;
-  if ((((l = _nthm_scope_level (d, err)) < s->depth) ? IER(263) : 0) ? (s->valid = MUGGLE(91)) : 0)
-	 goto b;
-  for (l = l - s->depth; l; l--)
-	 if (((e = e->enclosure) ? 0 : IER(264)) ? (d->valid = MUGGLE(92)) : 0)
-		goto b;
-  if (! _nthm_severed (b = s->reader->complement, err))                                 // remove s from d's blockers
-	 goto b;
-  s->yielded = _nthm_enqueued (b, &(e->finishers), &(e->finisher_queue), err);          // install s in d's finishers
-  if ((s->yielded ? 0 : _nthm_freed (b, err) ? 1 : IER(265)) ? (s->yielded = 1) : 0)
-	 s->valid = MUGGLE(93);
-  if (pthread_cond_signal (&(d->progress)) ? IER(266) : 0)
-	 d->valid = MUGGLE(94);
   if (s->status ? 0 : (s->status = *err))
 	 *err = 0;
- b: if (pthread_mutex_unlock (&(d->lock)) ? IER(267) : 0)
+  __atomic_store_n (&(s->yielded), 1, __ATOMIC_RELEASE);
+  do
+	 s->arrival = a = __atomic_load_n (&(d->arrivals), __ATOMIC_RELAXED);
+  while (__sync_val_compare_and_swap (&(d->arrivals), a, s) != a);
+  last = 0;
+  if ((__atomic_load_n (&(d->joining), __ATOMIC_SEQ_CST) != s->depth + 1) ? 0 : ! __atomic_exchange_n (&(s->tallied), 1, __ATOMIC_ACQ_REL))
+	 last = ! __atomic_sub_fetch (&(d->pending), 1, __ATOMIC_ACQ_REL);
+  woken = (last ? 1 : a ? 0 : ! ! __atomic_load_n (&(d->sleeping), __ATOMIC_SEQ_CST));
+  if (woken ? 0 : ! __atomic_load_n (&(d->herald), __ATOMIC_SEQ_CST))
+	 goto a;
+  if ((_nthm_lock (&(d->lock)) ? IER(261) : 0) ? (d->valid = MUGGLE(89)) : 0)
+	 goto a;
+  if ((h = ((d->herald_depth == s->depth) ? d->herald : NULL)))
+	 {
+		k = d->heralded;
+		__atomic_store_n (&(d->herald), NULL, __ATOMIC_RELAXED);
+	 }
+  if ((woken ? _nthm_progress_signal (&(d->lock)) : 0) ? IER(266) : 0)
+	 d->valid = MUGGLE(94);
+  if (_nthm_unlock (&(d->lock)) ? IER(267) : 0)
 	 d->valid = MUGGLE(95);
- a: if (pthread_mutex_unlock (&(s->lock)) ? IER(268) : 0)
+ a: if (_nthm_unlock (&(s->lock)) ? IER(268) : 0)
 	 s->valid = MUGGLE(96);
+  notified (h, k, err);
 }
 
 
@@ -220,16 +393,57 @@ yield (source, err)
 	  // Lock the source to stop it changing between tethered and
 	  // untethered, and then yield according to the corresponding
 	  // protocol. The source has to be flushed before being allowed
-	  // into its reader's finishers queue.
+	  // into its reader's finishers queue. A notifier set by
+	  // nthm_notify is taken while the source is locked and called
+	  // after it's unlocked, unless the source has been killed, in
+	  // which case nothing will read it.
 {
-  if ((! _nthm_descendants_killed (source, err)) ? 1 : (! source) ? IER(269) : (source->valid != MAGIC) ? IER(270) : 0)
+  nthm_notifier n;
+  void *c;
+
+  if ((! _nthm_descendants_killed (source, 0, err)) ? 1 : (! source) ? IER(269) : (source->valid != MAGIC) ? IER(270) : 0)
 	 return;
-  if ((pthread_mutex_lock (&(source->lock)) ? IER(271) : 0) ? (source->valid = MUGGLE(97)) : 0)
+  if ((_nthm_lock (&(source->lock)) ? IER(271) : 0) ? (source->valid = MUGGLE(97)) : 0)
 	 return;
+  n = (source->killed ? NULL : source->notifier);
+  c = source->notice;
+  source->notifier = NULL;
   if (source->killed ? 1 : !(source->reader))
 	 untethered_yield (source, err);
   else
 	 tethered_yield (source, err);
+  notified (n, c, err);
+}
+
+
+
+
+
+
+
+
+static void
+executed (s, skipped, err)
+	  nthm_pipe s;
+	  int skipped;
+	  int *err;
+
+	  // Run the function stored in a pipe s in the current context
+	  // unless skipped, and yield when finished.
+{
+  if (skipped)
+	 goto a;
+  if (s->write_only)
+	 (s->mutator) (s->operand);
+  else
+	 s->result = (s->operator) (s->operand, &(s->status));
+ a: _nthm_release (s->spill, s->spilled);
+  s->spill = NULL;
+  _nthm_vacate_scopes (s, err);
+  if (!(s->write_only))
+	 yield (s, err);
+  else if (! _nthm_acknowledged (s, err))
+	 deadlocked = 1;
 }
 
 
@@ -244,33 +458,34 @@ _nthm_manager (void_pointer)
 	  void *void_pointer;
 
 	  // Used as a start routine for pthread_create, this function runs
-	  // the given function in the created thread and yields when
-	  // finished.
+	  // the function stored in the given pipe and yields when
+	  // finished. If the thread can't be registered, the function is
+	  // skipped but the pipe still yields so that it can be retired.
+	  // A thread counted against the thread limit of its runtime then
+	  // runs any pipes waiting in the queue for a thread before
+	  // exiting. Whether it's counted is noted first because the pipe
+	  // may be retired as soon as it yields.
 {
-  thread_spec t;
+  nthm_runtime r;
   nthm_pipe s;
-  int err;
+  int err, registered, limited;
 
   err = 0;
-  if ((t = (thread_spec) void_pointer) ? 0 : (deadlocked = err = THE_IER(272)))
+  if (((s = (nthm_pipe) void_pointer) ? (s->valid != MAGIC) : 1) ? (deadlocked = err = THE_IER(272)) : 0)
 	 goto a;
-  if (((!(s = t->pipe)) ? 1 : (s->valid != MAGIC) ? 1 : ! _nthm_set_context (s, &err)) ? (deadlocked = err = THE_IER(273)) : 0)
+  r = s->runtime;
+  limited = s->limited;
+  if (_nthm_set_context (s, &err) ? 0 : (deadlocked = err = THE_IER(273)))
 	 goto b;
-  if (_nthm_registered (&err) ? 0 : (deadlocked = 1))
-	 goto c;
-  t->pipe = NULL;
-  if (t->write_only)
-	 (t->mutator) (t->operand);
-  else
-	 s->result = (t->operator) (t->operand, &(s->status));
-  _nthm_vacate_scopes (s, &err);
-  if (!(t->write_only))
-	 yield (s, &err);
-  else if (! _nthm_acknowledged (s, &err))
+  if (! (registered = _nthm_registered (r, &err)))
 	 deadlocked = 1;
- c: _nthm_clear_context (&err);
- b: _nthm_unspecify (t, &err);
-  _nthm_relay_race (&err);
+  do
+	 {
+		executed (s, ! registered, &err);
+		_nthm_clear_context (&err);
+	 }
+  while ((registered ? limited : 0) ? ((s = _nthm_next_queued (r, &err)) ? _nthm_set_context (s, &err) : 0) : 0);
+ b: _nthm_relay_race (r, &err);
  a: _nthm_globally_throw (err);
   pthread_exit (NULL);
 }
@@ -281,6 +496,40 @@ _nthm_manager (void_pointer)
 
 
 
+
+void
+_nthm_inlined (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Run a source that was waiting in the queue of its runtime for a
+	  // thread in the current thread instead, as its own thread would
+	  // have, and then restore the current thread's context. This
+	  // happens when the current thread would otherwise sleep waiting
+	  // for the source, so the source is finished when this function
+	  // returns. Errors are reported to the source as they would be in
+	  // its own thread rather than to the caller.
+{
+  nthm_pipe c;
+  int e;
+
+  e = 0;
+  if ((! source) ? IER(506) : (source->valid != MAGIC) ? IER(507) : 0)
+	 return;
+  c = _nthm_current_context ();
+  if (_nthm_set_context (source, &e))
+	 executed (source, 0, &e);
+  _nthm_set_context (c, &e);
+  _nthm_globally_throw (e);
+}
+
+
+
+
+
+
+
+
 int *
 _nthm_deadlocked ()
 
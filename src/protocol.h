@@ -21,18 +21,26 @@
 
 // non-API routines pertaining to dataflow among threads
 
-// read from a pipe with no designated drain
+// read from a pipe with no designated drain, polling up to the given number of times before sleeping
 extern void *
-_nthm_untethered_read (nthm_pipe source, int *err);
+_nthm_untethered_read (nthm_pipe source, unsigned long polls, int *err);
 
-// read from a source whose drain is running in the current context
+// read from a source whose drain is running in the current context, polling similarly
 extern void *
-_nthm_tethered_read (nthm_pipe source, int *err);
+_nthm_tethered_read (nthm_pipe source, unsigned long polls, int *err);
+
+// read from a source that has already yielded and is untethered or drained by the current context
+extern void *
+_nthm_finished_read (nthm_pipe source, int *done, int *err);
 
 // used as a start routine for pthread_create
 extern void *
 _nthm_manager (void *void_pointer);
 
+// run a source taken off the queue of its runtime in the current thread
+extern void
+_nthm_inlined (nthm_pipe source, int *err);
+
 // return the address of a location used for reporting unrecoverable pthread errors
 extern int *
 _nthm_deadlocked (void);
@@ -0,0 +1,233 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "errs.h"
+#include "runtime.h"
+#include "sync.h"
+#include "pool.h"
+#include "stock.h"
+
+// the runtime used by threads that haven't selected another
+static struct nthm_runtime_struct default_runtime;
+
+// list of all runtimes not yet freed, starting with the most recently created
+static nthm_runtime runtimes = NULL;
+
+// secures mutually exclusive access to the list of runtimes
+static pthread_mutex_t runtime_lock;
+
+
+
+
+// --------------- initialization and teardown -------------------------------------------------------------
+
+
+
+
+
+
+static int
+opened (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Initialize the fields of a runtime and push it onto the list of
+	  // runtimes.
+{
+  memset (r, 0, sizeof (*r));
+  if (! _nthm_open_sync (r, err))
+	 return 0;
+  if (! _nthm_open_pool (r, err))
+	 goto a;
+  r->spin = ((sysconf (_SC_NPROCESSORS_ONLN) > 1) ? NTHM_POLLS : 0);    // polling is futile without another processor
+  r->valid = MAGIC;
+  if (pthread_mutex_lock (&runtime_lock) ? IER(450) : 0)
+	 goto b;
+  r->next_runtime = runtimes;
+  runtimes = r;
+  if (!(pthread_mutex_unlock (&runtime_lock) ? IER(451) : 0))
+	 return 1;
+ b: _nthm_close_pool (r, err);
+ a: _nthm_close_sync (r, err);
+  r->valid = MUGGLE(149);
+  return 0;
+}
+
+
+
+
+
+
+
+
+int
+_nthm_open_runtimes (err)
+	  int *err;
+
+	  // Initialize static storage, including the default runtime.
+{
+  pthread_mutexattr_t a;
+
+  if (! _nthm_error_checking_mutex_type (&a, err))
+	 return 0;
+  if (pthread_mutex_init (&runtime_lock, &a) ? IER(452) : 0)
+	 {
+		pthread_mutexattr_destroy (&a);
+		return 0;
+	 }
+  if ((pthread_mutexattr_destroy (&a) ? IER(453) : 0) ? 0 : opened (&default_runtime, err))
+	 return 1;
+  pthread_mutex_destroy (&runtime_lock);
+  return 0;
+}
+
+
+
+
+
+
+
+
+void
+_nthm_close_runtimes ()
+
+	  // Reclaim all runtimes that haven't been freed and report errors
+	  // on stderr. The root pools of all runtimes are reclaimed before
+	  // any runtime's threads are joined, and runtimes are freed only
+	  // after all of them are joined, because threads in one runtime
+	  // may be reading pipes in another.
+{
+  nthm_runtime q, r;
+  int err;
+
+  if (pthread_mutex_lock (&runtime_lock))
+	 {
+		_nthm_globally_throw (THE_IER(454));
+		return;
+	 }
+  q = runtimes;
+  runtimes = NULL;
+  _nthm_globally_throw (pthread_mutex_unlock (&runtime_lock) ? THE_IER(455) : 0);
+  for (r = q; r; r = r->next_runtime)
+	 {
+		err = 0;
+		_nthm_close_pool (r, &err);
+		_nthm_globally_throw (err);
+	 }
+  for (r = q; r; r = r->next_runtime)
+	 {
+		err = 0;
+		_nthm_close_sync (r, &err);
+		_nthm_globally_throw (err);
+	 }
+  while ((r = q))
+	 {
+		q = r->next_runtime;
+		r->valid = MUGGLE(150);
+		if (r != &default_runtime)
+		  _nthm_release (r, sizeof (*r));
+	 }
+  _nthm_globally_throw (pthread_mutex_destroy (&runtime_lock) ? THE_IER(456) : 0);
+}
+
+
+
+
+
+
+
+
+// --------------- runtime management ----------------------------------------------------------------------
+
+
+
+
+
+
+nthm_runtime
+_nthm_default_runtime ()
+
+	  // Return the runtime used by threads that haven't selected
+	  // another.
+{
+  return &default_runtime;
+}
+
+
+
+
+
+
+
+
+nthm_runtime
+_nthm_new_runtime (err)
+	  int *err;
+
+	  // Allocate and initialize a runtime.
+{
+  nthm_runtime r;
+
+  if (! (r = (nthm_runtime) _nthm_allocation (sizeof (*r), _Alignof (struct nthm_runtime_struct), err)))
+	 return NULL;
+  if (opened (r, err))
+	 return r;
+  _nthm_release (r, sizeof (*r));
+  return NULL;
+}
+
+
+
+
+
+
+
+
+void
+_nthm_runtime_closed (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Take a runtime off the list of runtimes, reclaim its root pool,
+	  // join with its threads and free it. The default runtime is
+	  // never freed this way.
+{
+  nthm_runtime *q;
+
+  if ((! r) ? IER(457) : (r->valid != MAGIC) ? IER(458) : (r == &default_runtime) ? IER(459) : 0)
+	 return;
+  if (pthread_mutex_lock (&runtime_lock) ? IER(460) : 0)
+	 return;
+  for (q = &runtimes; *q ? (*q != r) : 0; q = &((*q)->next_runtime));
+  if (*q ? 0 : IER(461))
+	 r = NULL;
+  else
+	 *q = r->next_runtime;
+  if ((pthread_mutex_unlock (&runtime_lock) ? IER(462) : 0) ? 1 : ! r)
+	 return;
+  _nthm_close_pool (r, err);
+  _nthm_close_sync (r, err);
+  r->valid = MUGGLE(151);
+  _nthm_release (r, sizeof (*r));
+}
@@ -0,0 +1,99 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+// non-API operations on runtimes, each of which owns a root pool, the
+// synchronization of the threads created in it, and its own settings
+// and statistics
+
+#ifndef NTHM_RUNTIME_H
+#define NTHM_RUNTIME_H 1
+
+#include <nthm.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "pipes.h"
+
+#ifndef CACHE_LINE
+// assumed size in bytes of a cache line, used to keep fields used by different modules apart
+#define CACHE_LINE 64
+#endif
+
+// Fields are grouped by the module that uses them and each group
+// starts on its own cache line, so that threads starting, finishing
+// and pooling pipes don't invalidate each other's cache lines.
+
+struct nthm_runtime_struct
+{
+  // written by the thread creating or destroying the runtime
+  int valid;                       // MAGIC if the runtime is usable, a muggle otherwise
+  nthm_runtime next_runtime;       // the next runtime in the list of all of them
+  // used by the root pool
+  _Alignas (CACHE_LINE)
+  pipe_list root_pipes;            // list of untethered and top pipes to be freed on exit
+  pthread_mutex_t root_lock;       // enforces mutually exclusive access to the root pipe list
+  int shut_down;                   // non-zero if no more threads are to be created, set by nthm_shutdown
+  // used for starting threads
+  _Alignas (CACHE_LINE)
+  uintptr_t starters;              // number of created threads whose creation has not yet been confirmed
+  pthread_cond_t started;          // wakes up threads waiting for confirmation in _nthm_started
+  pthread_mutex_t starter_lock;    // secures mutually exclusive access to starters and started
+  // used for joining threads
+  _Alignas (CACHE_LINE)
+  int starting;                    // non-zero if a thread has been created since the last synchronization
+  uintptr_t runners;               // number of extant threads not yet joined
+  pthread_mutex_t runner_lock;     // secures mutually exclusive access to the fields in this group
+  int finishers;                   // non-zero when there is a thread waiting to be joined
+  pthread_cond_t finished;         // wakes up threads waiting to be joined
+  pthread_t finishing_thread;      // the waiting thread to be joined next
+  pthread_cond_t last_runner;      // signaled when at most one thread is left running
+  // used for queuing pipes when the number of threads is limited
+  _Alignas (CACHE_LINE)
+  unsigned long limit;             // most threads counted as active at once, or zero for no limit, set by nthm_set_concurrency
+  uintptr_t active;                // number of threads counted against the limit and not yet finished
+  pipe_list queue;                 // pipes waiting for a thread, in the order they were opened
+  pipe_list queue_tail;            // the last pipe in the queue
+  pthread_mutex_t queue_lock;      // secures mutually exclusive access to the fields in this group
+  // settings and statistics updated by any thread
+  _Alignas (CACHE_LINE)
+  unsigned long spin;              // number of times to poll for a result before sleeping
+  struct nthm_statistics tally;    // counts of waits for results reported by nthm_get_statistics
+};
+
+// initialize the default runtime and the list of runtimes
+extern int
+_nthm_open_runtimes (int *err);
+
+// reclaim all runtimes at exit and report errors on stderr
+extern void
+_nthm_close_runtimes (void);
+
+// return the runtime used by threads that haven't selected another
+extern nthm_runtime
+_nthm_default_runtime (void);
+
+// allocate and initialize a runtime
+extern nthm_runtime
+_nthm_new_runtime (int *err);
+
+// reclaim the pipes and threads of a runtime and free it
+extern void
+_nthm_runtime_closed (nthm_runtime r, int *err);
+
+#endif
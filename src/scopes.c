@@ -26,6 +26,7 @@
 #include "errs.h"
 #include "pipes.h"
 #include "scopes.h"
+#include "stock.h"
 #include "plumbing.h"
 #include "nthmconfig.h"
 #ifdef MEMTEST                // keep a count of allocated structures; not suitable for production code
@@ -34,9 +35,12 @@
 // used to initialize static storage
 static pthread_once_t once_control = PTHREAD_ONCE_INIT;
 
-// number of scopes in memory
+// number of scope stacks in memory
 static uintptr_t scopes = 0;
 
+// number of arena chunks in memory
+static uintptr_t chunks = 0;
+
 // mutually exclusion for the count
 static pthread_mutex_t memtest_lock;
 
@@ -88,7 +92,9 @@ _nthm_close_scopes ()
   pthread_once (&once_control, lazy_initialization);
   _nthm_globally_throw (pthread_mutex_destroy (&memtest_lock) ? THE_IER(276) : 0);
   if (scopes)
-	 fprintf (stderr, "%lu unreclaimed scope%s\n", scopes, scopes == 1 ? "" : "s");
+	 fprintf (stderr, "%lu unreclaimed scope stack%s\n", scopes, scopes == 1 ? "" : "s");
+  if (chunks)
+	 fprintf (stderr, "%lu unreclaimed arena chunk%s\n", chunks, chunks == 1 ? "" : "s");
 #endif
 }
 
@@ -106,35 +112,131 @@ _nthm_close_scopes ()
 
 
 
+static void
+discarded (c)
+	  chunk c;
+
+	  // Free a list of arena chunks.
+{
+  chunk p;
+
+  while ((p = c))
+	 {
+		c = c->previous;
+		_nthm_release (p, sizeof (*p) + p->room);
+#ifdef MEMTEST
+		pthread_mutex_lock (&memtest_lock);
+		chunks--;
+		pthread_mutex_unlock (&memtest_lock);
+#endif
+	 }
+}
+
+
+
+
+
+
+
+
+static void
+released (p, err)
+	  nthm_pipe p;
+	  int *err;
+
+	  // Return the scope stack of a pipe p to the stockpile if it has
+	  // never grown or free it otherwise.
+{
+  if (p->room == SCOPE_ROOM)
+	 _nthm_deposit (SCOPE_STOCK, p->scopes, SCOPE_ROOM * sizeof (*(p->scopes)), err);
+  else
+	 _nthm_release (p->scopes, p->room * sizeof (*(p->scopes)));
+}
+
+
+
+
+
+
+
+
+static int
+grown (p, err)
+	  nthm_pipe p;
+	  int *err;
+
+	  // Make room for another scope in the scope stack of a locked
+	  // pipe p, either by taking one from the stockpile if it has
+	  // none or by doubling its size. The first entry in each list of
+	  // blockers, finishers or casualties refers back to the scope
+	  // that holds it, so these references have to follow the scopes
+	  // when they're moved.
+{
+  scope_stack e;
+  uintptr_t l;
+
+  if (p->scopes)
+	 goto a;
+  if (! (p->scopes = (scope_stack) _nthm_withdrawal (SCOPE_STOCK, SCOPE_ROOM * sizeof (*e), _Alignof (struct scope_stack_struct), err)))
+	 return 0;
+  p->room = SCOPE_ROOM;
+#ifdef MEMTEST
+  pthread_mutex_lock (&memtest_lock);
+  scopes++;
+  pthread_mutex_unlock (&memtest_lock);
+#endif
+  return 1;
+ a: if (! (e = (scope_stack) _nthm_allocation ((p->room << 1) * sizeof (*e), _Alignof (struct scope_stack_struct), err)))
+	 return 0;
+  memcpy (e, p->scopes, p->room * sizeof (*e));
+  for (l = 0; l < p->room; l++)
+	 {
+		if (e[l].blockers)
+		  e[l].blockers->previous_pipe = &(e[l].blockers);
+		if (e[l].finishers)
+		  e[l].finishers->previous_pipe = &(e[l].finishers);
+		if (e[l].casualties)
+		  e[l].casualties->previous_pipe = &(e[l].casualties);
+	 }
+  released (p, err);
+  p->scopes = e;
+  p->room = p->room << 1;
+  p->scope = e + p->level;
+  return 1;
+}
+
+
+
+
+
+
+
+
 int
 _nthm_scope_entered (p, err)
 	  nthm_pipe p;
 	  int *err;
 
 	  // Enter a local scope by pushing the current descendants into an
-	  // enclosing scope.
+	  // enclosing scope. A new pipe has no scopes until it enters
+	  // the one at level zero.
 {
-  scope_stack e;
+  uintptr_t l;
 
 #ifdef MEMTEST
   pthread_once (&once_control, lazy_initialization);
 #endif
-  if ((e = (scope_stack) malloc (sizeof (*e))) ? 0 : (*err = (*err ? *err : ENOMEM)))
-	 return 0;
   if ((! p) ? IER(277) : (p->valid != MAGIC) ? IER(278) : 0)
+	 return 0;
+  if ((_nthm_lock (&(p->lock)) ? IER(279) : 0) ? (p->valid = MUGGLE(98)) : 0)
+	 return 0;
+  l = (p->scope ? (p->level + 1) : 0);
+  if ((l < p->room) ? 0 : ! grown (p, err))
 	 goto a;
-  if ((pthread_mutex_lock (&(p->lock)) ? IER(279) : 0) ? (p->valid = MUGGLE(98)) : 0)
-	 goto a;
-  memset (e, 0, sizeof (*e));
-  e->enclosure = p->scope;
-  p->scope = e;
-#ifdef MEMTEST
-  pthread_mutex_lock (&memtest_lock);
-  scopes++;
-  pthread_mutex_unlock (&memtest_lock);
-#endif
-  return ((pthread_mutex_unlock (&(p->lock)) ? IER(280) : 0) ? (!(p->valid = MUGGLE(99))) : 1);
- a: free (e);
+  memset (p->scope = p->scopes + (p->level = l), 0, sizeof (*(p->scope)));
+  return ((_nthm_unlock (&(p->lock)) ? IER(280) : 0) ? (!(p->valid = MUGGLE(99))) : 1);
+ a: if (_nthm_unlock (&(p->lock)) ? IER(362) : 0)
+	 p->valid = MUGGLE(107);
   return 0;
 }
 
@@ -152,28 +254,44 @@ _nthm_scope_exited (p, err)
 	  int *err;
 
 	  // Exit a scope by retrieving the former descendants from an
-	  // enclosing scope.
+	  // enclosing scope. Exiting the scope at level zero leaves the
+	  // pipe with no scopes and releases its scope stack. Storage
+	  // allocated in the exited scope is freed after the pipe is
+	  // unlocked.
 {
   scope_stack e;
+  chunk arena;
+  int exited;
 
 #ifdef MEMTEST
   pthread_once (&once_control, lazy_initialization);
 #endif
   e = NULL;
+  arena = NULL;
   if ((! p) ? IER(281) : (p->valid != MAGIC) ? IER(282) : ((e = p->scope) ? 0 : IER(283)) ? (p->valid = MUGGLE(100)) : 0)
 	 return 0;
-  if ((pthread_mutex_lock (&(p->lock)) ? IER(284) : 0) ? (p->valid = MUGGLE(101)) : 0)
+  if ((_nthm_lock (&(p->lock)) ? IER(284) : 0) ? (p->valid = MUGGLE(101)) : 0)
 	 return 0;
   if (e->blockers ? IER(285) : e->finishers ? IER(286) : e->finisher_queue ? IER(287) : 0)
 	 goto a;
-  p->scope = e->enclosure;
-  free (e);
+  arena = e->arena;
+  e->arena = NULL;
+  if (p->level)
+	 {
+		p->scope = p->scopes + --(p->level);
+		goto a;
+	 }
+  released (p, err);
+  p->scope = p->scopes = NULL;
+  p->room = 0;
 #ifdef MEMTEST
   pthread_mutex_lock (&memtest_lock);
   scopes--;
   pthread_mutex_unlock (&memtest_lock);
 #endif
- a: return ((pthread_mutex_unlock (&(p->lock)) ? IER(288) : 0) ? (!(p->valid = MUGGLE(102))) : 1);
+ a: exited = ((_nthm_unlock (&(p->lock)) ? IER(288) : 0) ? (!(p->valid = MUGGLE(102))) : 1);
+  discarded (arena);
+  return exited;
 }
 
 
@@ -190,19 +308,11 @@ _nthm_scope_level (p, err)
 	  // Return the current scope level of a pipe, defined as the
 	  // number of times code running in its context has called
 	  // scope_entered minus the number of times it has called
-	  // scope_exited, and computed from the length of the list of
-	  // enclosing scopes.
+	  // scope_exited, not counting the scope it starts with.
 {
-  uintptr_t d;
-  scope_stack e;
-
-  e = NULL;
-  if ((! p) ? IER(289) : (p->valid != MAGIC) ? IER(290) : ((e = p->scope) ? 0 : IER(291)) ? (p->valid = MUGGLE(103)) : 0)
+  if ((! p) ? IER(289) : (p->valid != MAGIC) ? IER(290) : (p->scope ? 0 : IER(291)) ? (p->valid = MUGGLE(103)) : 0)
 	 return 0;
-  d = 0;
-  for (e = e->enclosure; e; e = e->enclosure)
-	 d++;
-  return d;
+  return p->level;
 }
 
 
@@ -244,9 +354,140 @@ _nthm_vacate_scopes (s, err)
 	 return;
   if ((s->scope ? 0 : IER(296)) ? (! (s->valid = MUGGLE(104))) : 0)
 	 return;
-  while (s->scope->enclosure ? (*err = (*err ? *err : NTHM_XSCOPE)) : 0)
+  while (s->level ? (*err = (*err ? *err : NTHM_XSCOPE)) : 0)
 	 if (!(_nthm_descendants_untethered (s, err) ? _nthm_scope_exited (s, err) : 0))
 		break;
 }
 
 
+
+
+
+
+
+
+
+// --------------- scope arenas ----------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+void *
+_nthm_scope_allocation (p, size, err)
+	  nthm_pipe p;
+	  size_t size;
+	  int *err;
+
+	  // Allocate storage suitably aligned for anything from the arena
+	  // of the current scope of a pipe p by advancing past it in the
+	  // current chunk, adding a new chunk if there isn't enough room.
+	  // An allocation too big for a chunk of the usual size gets a
+	  // chunk of its own, which goes behind the current one so that
+	  // the room left in the current one isn't wasted. Only the thread
+	  // running in the pipe's context touches its arena, so no lock is
+	  // needed.
+{
+  scope_stack e;
+  size_t need;
+  chunk c, n;
+  void *item;
+
+#ifdef MEMTEST
+  pthread_once (&once_control, lazy_initialization);
+#endif
+  if ((! p) ? IER(464) : (p->valid != MAGIC) ? IER(465) : ((e = p->scope) ? 0 : IER(466)) ? (p->valid = MUGGLE(152)) : 0)
+	 return NULL;
+  need = (size + _Alignof (max_align_t) - 1) & ~(_Alignof (max_align_t) - 1);
+  if (((need < size) ? 1 : (need > SIZE_MAX - sizeof (*n))) ? (*err = (*err ? *err : ENOMEM)) : 0)
+	 return NULL;
+  if ((c = e->arena) ? (c->room - c->used >= need) : 0)
+	 goto a;
+  if (! (n = (chunk) _nthm_allocation (sizeof (*n) + ((need > ARENA_ROOM) ? need : ARENA_ROOM), _Alignof (struct chunk_struct), err)))
+	 return NULL;
+#ifdef MEMTEST
+  pthread_mutex_lock (&memtest_lock);
+  chunks++;
+  pthread_mutex_unlock (&memtest_lock);
+#endif
+  n->room = ((need > ARENA_ROOM) ? need : ARENA_ROOM);
+  n->used = 0;
+  if ((need > ARENA_ROOM) ? ! c : 1)
+	 {
+		n->previous = c;
+		e->arena = c = n;
+		goto a;
+	 }
+  n->previous = c->previous;
+  c->previous = n;
+  n->used = need;
+  return (void *) n->bytes;
+ a: item = (void *) ((unsigned char *) c->bytes + c->used);
+  c->used += need;
+  return item;
+}
+
+
+
+
+
+
+
+
+chunk
+_nthm_arena_detached (p, err)
+	  nthm_pipe p;
+	  int *err;
+
+	  // Detach the arena from the current scope of a pipe p so that it
+	  // outlives the pipe.
+{
+  chunk arena;
+
+  if ((! p) ? IER(467) : (p->valid != MAGIC) ? IER(468) : ! (p->scope))
+	 return NULL;
+  arena = p->scope->arena;
+  p->scope->arena = NULL;
+  return arena;
+}
+
+
+
+
+
+
+
+
+void
+_nthm_arena_adopted (p, arena, err)
+	  nthm_pipe p;
+	  chunk arena;
+	  int *err;
+
+	  // Append a detached arena to the arena of the current scope of a
+	  // pipe p, behind its current chunk, so that it's freed when that
+	  // scope is exited. If p is NULL, the arena is freed right away.
+	  // The pipe is assumed to belong to the current thread's context.
+{
+  scope_stack e;
+  chunk t;
+
+  if (! arena)
+	 return;
+  if ((! p) ? 1 : (p->valid != MAGIC) ? IER(469) : (e = p->scope) ? 0 : IER(470))
+	 {
+		discarded (arena);
+		return;
+	 }
+  for (t = arena; t->previous; t = t->previous);
+  if (! (e->arena))
+	 {
+		e->arena = arena;
+		return;
+	 }
+  t->previous = e->arena->previous;
+  e->arena->previous = arena;
+}
@@ -25,15 +25,40 @@
 
 // non-API scope stack operations
 
+// number of scopes a pipe's scope stack has room for before it grows beyond its stockpiled size
+#define SCOPE_ROOM 4
+
+// number of bytes in each chunk of a scope's arena unless a larger allocation needs a chunk of its own
+#define ARENA_ROOM 4096
+
 typedef struct scope_stack_struct *scope_stack;
 
+typedef struct chunk_struct *chunk;
+
+// Storage allocated by nthm_scope_alloc is carved from chunks linked
+// in order of decreasing recency, with the current chunk first.
+
+struct chunk_struct
+{
+  chunk previous;             // the chunk allocated before this one in the same scope, if any
+  size_t room;                // number of bytes available in the chunk
+  size_t used;                // number of bytes already allocated from the chunk
+  max_align_t bytes[];        // the storage itself, suitably aligned for anything
+};
+
+// Each pipe keeps its scopes in an array indexed by scope level,
+// which is doubled in size when it runs out of room and never shrunk
+// until the pipe is retired.
+
 struct scope_stack_struct
 {
   unsigned truncation;        // set by user code when a partial result is acceptable
   pipe_list blockers;         // a list of pipes whose results are awaited
   pipe_list finishers;        // a list of pipes whose results are available in the order they finished
   pipe_list finisher_queue;   // points to the most recently finished pipe in this scope
-  scope_stack enclosure;      // specifications of enclosing scopes
+  uintptr_t epoch;            // incremented to cancel all sources tethered in this scope before then
+  pipe_list casualties;       // cancelled sources that hadn't yet finished when they were cancelled
+  chunk arena;                // storage allocated by nthm_scope_alloc in this scope, freed when it's exited
 };
 
 // enter a local scope by pushing the current descendants into an enclosing scope
@@ -56,6 +81,18 @@ _nthm_drained_by (nthm_pipe s, nthm_pipe d, int *err);
 extern void
 _nthm_vacate_scopes (nthm_pipe s, int *err);
 
+// allocate storage from the arena of a pipe's current scope
+extern void *
+_nthm_scope_allocation (nthm_pipe p, size_t size, int *err);
+
+// detach the arena from the current scope of a pipe about to be retired
+extern chunk
+_nthm_arena_detached (nthm_pipe p, int *err);
+
+// append a detached arena to the current scope of a pipe, or free it if the pipe is NULL
+extern void
+_nthm_arena_adopted (nthm_pipe p, chunk arena, int *err);
+
 // report memory leaks
 extern void
 _nthm_close_scopes (void);
@@ -0,0 +1,319 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "errs.h"
+#include "stock.h"
+
+typedef struct stock_struct *stock;
+
+struct stock_struct
+{
+  void *items;                // a list of free structures linked through their first words
+  uintptr_t count;            // the number of structures in the list
+  uintptr_t limit;            // the greatest number of structures worth keeping, read without locking
+  size_t size;                // the size of each structure in the list, needed to free them
+  pthread_mutex_t lock;       // secures mutually exclusive access to the list and the count
+};
+
+// one stockpile for each kind of structure
+static struct stock_struct stocks[STOCKS];
+
+// allocates storage if set by nthm_set_allocator, instead of the system allocator
+static nthm_allocator allocator = NULL;
+
+// frees storage obtained from the allocator, if set
+static nthm_deallocator deallocator = NULL;
+
+// passed to the allocator and deallocator
+static void *allocator_context = NULL;
+
+// non-zero once anything has been allocated, after which the allocator can't be changed
+static int allocated = 0;
+
+
+
+
+// --------------- initialization and teardown -------------------------------------------------------------
+
+
+
+
+
+
+int
+_nthm_open_stocks (err)
+	  int *err;
+
+	  // Initialize static storage.
+{
+  pthread_mutexattr_t a;
+  unsigned k;
+
+  memset (stocks, 0, sizeof (stocks));
+  if (! _nthm_error_checking_mutex_type (&a, err))
+	 return 0;
+  for (k = 0; k < STOCKS; k++)
+	 if (pthread_mutex_init (&(stocks[k].lock), &a) ? IER(342) : 0)
+		break;
+  if ((pthread_mutexattr_destroy (&a) ? IER(343) : 0) ? 0 : (k == STOCKS))
+	 return 1;
+  while (k--)
+	 pthread_mutex_destroy (&(stocks[k].lock));
+  return 0;
+}
+
+
+
+
+
+
+
+void
+_nthm_close_stocks ()
+
+	  // Free the stockpiled structures and other static storage. This
+	  // function is called in the exit routine after all other
+	  // structures have been reclaimed.
+{
+  void *item;
+  unsigned k;
+
+  for (k = 0; k < STOCKS; k++)
+	 {
+		while ((item = stocks[k].items))
+		  {
+			 stocks[k].items = *((void **) item);
+			 _nthm_release (item, stocks[k].size);
+		  }
+		_nthm_globally_throw (pthread_mutex_destroy (&(stocks[k].lock)) ? THE_IER(344) : 0);
+	 }
+}
+
+
+
+
+
+// --------------- stockpile management --------------------------------------------------------------------
+
+
+
+
+
+
+
+void *
+_nthm_allocation (size, alignment, err)
+	  size_t size;
+	  size_t alignment;
+	  int *err;
+
+	  // Allocate storage with at least the given alignment, which is
+	  // assumed to be a power of two, using the allocator set by
+	  // nthm_set_allocator if there is one. Otherwise malloc is used
+	  // when its alignment suffices, and if not, the size is rounded
+	  // up to a multiple of the alignment as aligned_alloc requires.
+{
+  void *item;
+
+  if (! __atomic_load_n (&allocated, __ATOMIC_RELAXED))
+	 __atomic_store_n (&allocated, 1, __ATOMIC_RELAXED);
+  if (allocator)
+	 item = (allocator) (size, alignment, allocator_context);
+  else if (alignment <= _Alignof (max_align_t))
+	 item = malloc (size);
+  else
+	 item = aligned_alloc (alignment, (size + alignment - 1) & ~(alignment - 1));
+  if (! item)
+	 *err = (*err ? *err : ENOMEM);
+  return item;
+}
+
+
+
+
+
+
+
+
+void
+_nthm_release (item, size)
+	  void *item;
+	  size_t size;
+
+	  // Free storage of the given size obtained from _nthm_allocation.
+{
+  if (! item)
+	 return;
+  if (deallocator)
+	 (deallocator) (item, size, allocator_context);
+  else
+	 free (item);
+}
+
+
+
+
+
+
+
+
+int
+_nthm_allocator_set (allocate, release, context, err)
+	  nthm_allocator allocate;
+	  nthm_deallocator release;
+	  void *context;
+	  int *err;
+
+	  // Replace the system allocator with the given functions, or
+	  // restore it if both are NULL. This is possible only before
+	  // anything has been allocated, because storage has to be freed
+	  // by the same allocator that allocated it.
+{
+  if ((allocate ? ! release : ! ! release) ? (*err = (*err ? *err : EINVAL)) : 0)
+	 return 0;
+  if (__atomic_load_n (&allocated, __ATOMIC_ACQUIRE) ? (*err = (*err ? *err : EBUSY)) : 0)
+	 return 0;
+  allocator = allocate;
+  deallocator = release;
+  allocator_context = context;
+  return 1;
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_stockpiled (kind, size, alignment, n, err)
+	  unsigned kind;
+	  size_t size;
+	  size_t alignment;
+	  uintptr_t n;
+	  int *err;
+
+	  // Preallocate enough structures of the given kind, size and
+	  // alignment to bring the stockpile up to at least n, and keep at least that
+	  // many thereafter when they're freed.
+{
+  void *item;
+  stock s;
+
+  if ((kind < STOCKS) ? (size < sizeof (void *)) ? IER(345) : 0 : IER(346))
+	 return 0;
+  if (pthread_mutex_lock (&((s = &(stocks[kind]))->lock)) ? IER(347) : 0)
+	 return 0;
+  if (s->limit < n)
+	 __atomic_store_n (&(s->limit), n, __ATOMIC_RELAXED);
+  s->size = size;
+  while ((s->count < n) ? ! ! (item = _nthm_allocation (size, alignment, err)) : 0)
+	 {
+		*((void **) item) = s->items;
+		s->items = item;
+		s->count++;
+	 }
+  return ((pthread_mutex_unlock (&(s->lock)) ? IER(348) : 0) ? 0 : ! *err);
+}
+
+
+
+
+
+
+
+
+
+void *
+_nthm_withdrawal (kind, size, alignment, err)
+	  unsigned kind;
+	  size_t size;
+	  size_t alignment;
+	  int *err;
+
+	  // Return a structure of the given kind taken from the stockpile
+	  // if possible or newly allocated otherwise. If nothing has ever
+	  // been stockpiled, the stockpile needn't be locked.
+{
+  void *item;
+  stock s;
+
+  item = NULL;
+  if ((kind < STOCKS) ? 0 : IER(349))
+	 return NULL;
+  if (! __atomic_load_n (&((s = &(stocks[kind]))->limit), __ATOMIC_RELAXED))
+	 goto a;
+  if (pthread_mutex_lock (&(s->lock)) ? IER(350) : 0)
+	 return NULL;
+  if ((item = s->items))
+	 {
+		s->items = *((void **) item);
+		s->count--;
+	 }
+  if ((pthread_mutex_unlock (&(s->lock)) ? IER(351) : 0) ? 1 : ! ! item)
+	 return item;
+ a: return _nthm_allocation (size, alignment, err);
+}
+
+
+
+
+
+
+
+
+
+void
+_nthm_deposit (kind, item, size, err)
+	  unsigned kind;
+	  void *item;
+	  size_t size;
+	  int *err;
+
+	  // Return a structure of the given kind and size to the
+	  // stockpile if the stockpile isn't full or free it otherwise.
+{
+  int kept;
+  stock s;
+
+  kept = 0;
+  if ((! item) ? IER(352) : (kind < STOCKS) ? 0 : IER(353))
+	 return;
+  if (! __atomic_load_n (&((s = &(stocks[kind]))->limit), __ATOMIC_RELAXED))
+	 goto a;
+  if (pthread_mutex_lock (&(s->lock)) ? IER(354) : 0)
+	 goto a;
+  if ((kept = (s->count < s->limit)))
+	 {
+		s->size = size;
+		*((void **) item) = s->items;
+		s->items = item;
+		s->count++;
+	 }
+  if (pthread_mutex_unlock (&(s->lock)))
+	 IER(355);
+ a: if (! kept)
+	 _nthm_release (item, size);
+}
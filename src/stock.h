@@ -0,0 +1,65 @@
+/*
+  nthm -- non-preemptive thread hierarchy manager
+
+  copyright (c) 2020-2023 Dennis Furey
+
+  Nthm is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Nthm is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public
+  License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with nthm. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <nthm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// non-API routines for keeping stockpiles of preallocated
+// structures, so that bursts of activity can be served without
+// calling the allocator, and for allocating through the application's
+// allocator if it supplies one
+
+// kinds of structures stockpiled
+#define PIPE_STOCK 0
+#define PIPE_LIST_STOCK 1
+#define SCOPE_STOCK 2
+#define STOCKS 3
+
+// initialize static storage
+extern int
+_nthm_open_stocks (int *err);
+
+// free the stockpiled structures and other static storage
+extern void
+_nthm_close_stocks (void);
+
+// preallocate at least the given number of structures of a given kind, size and alignment
+extern int
+_nthm_stockpiled (unsigned kind, size_t size, size_t alignment, uintptr_t n, int *err);
+
+// return a structure of the given kind taken from the stockpile if possible or allocated otherwise
+extern void *
+_nthm_withdrawal (unsigned kind, size_t size, size_t alignment, int *err);
+
+// return a structure of the given kind and size to the stockpile if there's room or free it otherwise
+extern void
+_nthm_deposit (unsigned kind, void *item, size_t size, int *err);
+
+// allocate storage of a given size and alignment with the application's allocator if any or the system's otherwise
+extern void *
+_nthm_allocation (size_t size, size_t alignment, int *err);
+
+// free storage of a given size obtained from _nthm_allocation
+extern void
+_nthm_release (void *item, size_t size);
+
+// replace the allocator before anything has been allocated
+extern int
+_nthm_allocator_set (nthm_allocator allocate, nthm_deallocator release, void *context, int *err);
@@ -26,47 +26,9 @@
 #include "errs.h"
 #include "sync.h"
 #include "pipes.h"
+#include "runtime.h"
+#include "stock.h"
 #include "nthmconfig.h"
-#ifdef MEMTEST                  // keep counts of allocated structures; not suitable for production code
-#include <stdio.h>
-
-// number of thread specifications in memory
-static uintptr_t thread_specs = 0;
-
-// for mutually exclusive access to the count
-static pthread_mutex_t memtest_lock;
-
-#endif // MEMTEST
-
-// non-zero means at least one thread has been created since the application started; used in the exit routine
-static int starting = 0;
-
-// the number of recently created threads whose creation has not yet been confirmed by a call to _nthm_started
-static uintptr_t starters = 0;
-
-// used to wake up threads waiting for confirmation in _nthm_started
-static pthread_cond_t started;
-
-// secures mutually exclusive access to starters and started
-static pthread_mutex_t starter_lock;
-
-// the number of currently extant threads not yet joined by _nthm_relay_race or _nthm_synchronize
-static uintptr_t runners = 0;
-
-// secures mutually exclusive access to runners and starting
-static pthread_mutex_t runner_lock;
-
-// non-zero when there is a thread waiting to be joined by _nthm_relay_race or _nthm_synchronize
-static int finishers = 0;
-
-// wakes up threads waitng to be joined
-static pthread_cond_t finished;
-
-// holds the thread id of the waiting thread to be joined next by _nthm_relay_race or _nthm_synchronize
-static pthread_t finishing_thread;
-
-// wakes up _nthm_synchronize when the last thread is ready to be joined
-static pthread_cond_t last_runner;
 
 // non-zero means unrecoverable pthread errors or counter overflows have sabotaged the synchronization protocol
 static int deadlocked = 0;
@@ -108,42 +70,36 @@ _nthm_stack_limited_thread_type (a, err)
 
 
 int
-_nthm_open_sync (err)
+_nthm_open_sync (r, err)
+	  nthm_runtime r;
 	  int *err;
 
-	  // Initialize static storage.
+	  // Initialize the thread synchronization fields of a runtime.
 {
   pthread_mutexattr_t a;
 
   if (deadlocked ? IER(300) : ! _nthm_error_checking_mutex_type (&a, err))
 	 return 0;
-  if (pthread_mutex_init (&starter_lock, &a) ? IER(301) : 0)
+  if (pthread_mutex_init (&(r->starter_lock), &a) ? IER(301) : 0)
 	 goto a;
-  if (pthread_mutex_init (&runner_lock, &a) ? IER(302) : 0)
+  if (pthread_mutex_init (&(r->runner_lock), &a) ? IER(302) : 0)
 	 goto b;
-#ifdef MEMTEST
-  if (pthread_mutex_init (&memtest_lock, &a) ? IER(303) : 0)
-	 goto c;
-#endif
-  if ((pthread_mutexattr_destroy (&a) ? 1 : pthread_cond_init (&last_runner, NULL)) ? IER(304) : 0)
+  if ((pthread_mutexattr_destroy (&a) ? 1 : pthread_cond_init (&(r->last_runner), NULL)) ? IER(304) : 0)
 	 goto d;
-  if (pthread_cond_init (&started, NULL) ? IER(305) : 0)
+  if (pthread_cond_init (&(r->started), NULL) ? IER(305) : 0)
 	 goto e;
-  if (pthread_cond_init (&finished, NULL) ? IER(306) : 0)
+  if (pthread_cond_init (&(r->finished), NULL) ? IER(306) : 0)
 	 goto f;
+  if (pthread_mutex_init (&(r->queue_lock), NULL) ? IER(474) : 0)
+	 goto g;
   return 1;
- f: pthread_cond_destroy (&started);
- e: pthread_cond_destroy (&last_runner);
- d: pthread_mutex_destroy (&runner_lock);
-  pthread_mutex_destroy (&starter_lock);
-#ifdef MEMTEST
-  pthread_mutex_destroy (&memtest_lock);
-#endif
+ g: pthread_cond_destroy (&(r->finished));
+ f: pthread_cond_destroy (&(r->started));
+ e: pthread_cond_destroy (&(r->last_runner));
+ d: pthread_mutex_destroy (&(r->runner_lock));
+  pthread_mutex_destroy (&(r->starter_lock));
   return 0;
-#ifdef MEMTEST
- c: pthread_mutex_destroy (&runner_lock);
-#endif
- b: pthread_mutex_destroy (&starter_lock);
+ b: pthread_mutex_destroy (&(r->starter_lock));
  a: pthread_mutexattr_destroy (&a);
   return 0;
 }
@@ -162,25 +118,24 @@ _nthm_open_sync (err)
 
 
 static void
-release_pthread_resources (err)
+release_pthread_resources (r, err)
+	  nthm_runtime r;
 	  int *err;
 
 	  // Release pthread related resources.
 {
-#ifdef MEMTEST
-  if (pthread_mutex_destroy (&memtest_lock))
-	 IER(307);
-#endif
-  if (pthread_mutex_destroy (&starter_lock))
+  if (pthread_mutex_destroy (&(r->starter_lock)))
 	 IER(308);
-  else if (pthread_cond_destroy (&started))
+  else if (pthread_cond_destroy (&(r->started)))
 	 IER(309);
-  if (pthread_mutex_destroy (&runner_lock) ? IER(310) : 0)
+  if (pthread_mutex_destroy (&(r->runner_lock)) ? IER(310) : 0)
 	 return;
-  if (pthread_cond_destroy (&finished))
+  if (pthread_cond_destroy (&(r->finished)))
 	 IER(311);
-  if (pthread_cond_destroy (&last_runner))
+  if (pthread_cond_destroy (&(r->last_runner)))
 	 IER(312);
+  if (r->queue ? IER(475) : pthread_mutex_destroy (&(r->queue_lock)) ? IER(476) : 0)
+	 return;
 }
 
 
@@ -191,22 +146,18 @@ release_pthread_resources (err)
 
 
 void
-_nthm_close_sync ()
+_nthm_close_sync (r, err)
+	  nthm_runtime r;
+	  int *err;
 
-	  // Free the static storage, synchronize with all threads and
-	  // report errors on stderr.
+	  // Synchronize with all threads in a runtime and free its
+	  // pthread resources.
 {
-  int err;
-
-  err = 0;
-  _nthm_synchronize (&err);
+  _nthm_synchronize (r, err);
   if (! deadlocked)
-	 release_pthread_resources (&err);
-  _nthm_globally_throw (err ? err : deadlocked ? THE_IER(313) : 0);
-#ifdef MEMTEST
-  if (thread_specs)
-	 fprintf (stderr, "%lu unreclaimed thread specification%s\n", thread_specs, thread_specs == 1 ? "" : "s");
-#endif
+	 release_pthread_resources (r, err);
+  else
+	 IER(313);
 }
 
 
@@ -215,7 +166,6 @@ _nthm_close_sync ()
 
 
 
-
 // --------------- memory management -----------------------------------------------------------------------
 
 
@@ -224,35 +174,29 @@ _nthm_close_sync ()
 
 
 
-thread_spec
-_nthm_thread_spec_of (source, operator, mutator, operand, write_only, err)
+nthm_pipe
+_nthm_specified (source, runtime, operator, mutator, operand, write_only, err)
 	  nthm_pipe source;
+	  nthm_runtime runtime;
 	  nthm_worker operator;
 	  nthm_slacker mutator;
 	  void *operand;
 	  int write_only;
 	  int *err;
 
-	  // Return a newly allocated and initialized thread_spec.
+	  // Store the parameters needed by _nthm_manager in the pipe of a
+	  // thread about to be created. Keeping them in the pipe rather
+	  // than in a separately allocated structure saves an allocation
+	  // per thread and lets the pipe alone be handed to the thread.
 {
-  thread_spec t;
-
-  t = NULL;
-  if (source ? ((t = (thread_spec) malloc (sizeof (*t))) ? 0 : (*err = (*err ? *err : ENOMEM))) : 1)
-	 if (source ? (_nthm_retired (source, err) ? 1 : IER(314)) : 1)
-		return NULL;
-  memset (t, 0, sizeof (*t));
-  t->write_only = write_only;
-  t->operator = operator;
-  t->mutator = mutator;
-  t->operand = operand;
-  t->pipe = source;
-#ifdef MEMTEST
-  pthread_mutex_lock (&memtest_lock);
-  thread_specs++;
-  pthread_mutex_unlock (&memtest_lock);
-#endif
-  return t;
+  if ((! source) ? 1 : (source->valid != MAGIC) ? IER(314) : 0)
+	 return NULL;
+  source->runtime = runtime;
+  source->write_only = write_only;
+  source->operator = operator;
+  source->mutator = mutator;
+  source->operand = operand;
+  return source;
 }
 
 
@@ -262,23 +206,31 @@ _nthm_thread_spec_of (source, operator, mutator, operand, write_only, err)
 
 
 
-
-void
-_nthm_unspecify (t, err)
-	  thread_spec t;
+nthm_pipe
+_nthm_copied (source, original, size, err)
+	  nthm_pipe source;
+	  const void *original;
+	  size_t size;
 	  int *err;
 
-	  // Free a thread specification structure.
+	  // Copy an operand into storage owned by the pipe of a thread
+	  // about to be created, and make the copy the thread's
+	  // operand. Small operands fit in the pipe itself. Larger ones
+	  // are copied to the heap and freed when the thread's user code
+	  // returns. If there's no memory, the pipe is retired.
 {
-  if (t ? 0 : IER(315))
-	 return;
-  if ((! (t->pipe)) ? 1 : (t->pipe->zombie = 1))
-	 free (t);
-#ifdef MEMTEST
-  pthread_mutex_lock (&memtest_lock);
-  thread_specs--;
-  pthread_mutex_unlock (&memtest_lock);
-#endif
+  if ((! source) ? 1 : (source->valid != MAGIC) ? IER(356) : 0)
+	 return NULL;
+  if ((! size) ? 1 : ! original)
+	 return source;
+  if ((size <= NTHM_OPERAND_MAX) ? 0 : (source->spill = _nthm_allocation (size, _Alignof (max_align_t), err)) ? ! (source->spilled = size) : 1)
+	 {
+		if (! _nthm_retired (source, err))
+		  IER(357);
+		return NULL;
+	 }
+  source->operand = memcpy (source->spill ? source->spill : source->copy.bytes, original, size);
+  return source;
 }
 
 
@@ -292,24 +244,25 @@ _nthm_unspecify (t, err)
 
  
 int
-_nthm_registered (err)
+_nthm_registered (r, err)
+	  nthm_runtime r;
 	  int *err;
 
 	  // Bump the count of running threads and assert that a thread
 	  // has started. This function should be called by the start
 	  // routine of a new thread when it starts.
 {
-  if (deadlocked ? 1 : pthread_mutex_lock (&runner_lock) ? (deadlocked = IER(316)) : 0)
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->runner_lock)) ? (deadlocked = IER(316)) : 0)
 	 return 0;
-  if ((runners += (uintptr_t) (starting = 1)) ? 0 : IER(317))
+  if ((r->runners += (uintptr_t) (r->starting = 1)) ? 0 : IER(317))
 	 deadlocked = 1;
-  if (pthread_mutex_unlock (&runner_lock) ? (deadlocked = IER(318)) : 0)
+  if (pthread_mutex_unlock (&(r->runner_lock)) ? (deadlocked = IER(318)) : 0)
 	 return 0;
-  if (deadlocked ? 1 : pthread_mutex_lock (&starter_lock) ? (deadlocked = IER(319)) : 0)
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->starter_lock)) ? (deadlocked = IER(319)) : 0)
 	 return 0;
-  if (starters++ ? 0 : (! starters) ? IER(320) : pthread_cond_broadcast (&started) ? IER(321) : 0)
+  if (r->starters++ ? 0 : (! r->starters) ? IER(320) : pthread_cond_broadcast (&(r->started)) ? IER(321) : 0)
 	 deadlocked = 1;
-  if (pthread_mutex_unlock (&starter_lock) ? IER(322) : 0)
+  if (pthread_mutex_unlock (&(r->starter_lock)) ? IER(322) : 0)
 	 deadlocked = 1;
   return ! deadlocked;
 }
@@ -323,7 +276,8 @@ _nthm_registered (err)
 
 
 int
-_nthm_started (err)
+_nthm_started (r, err)
+	  nthm_runtime r;
 	  int *err;
 
 	  // Safely confirm that a thread has started. This function
@@ -331,11 +285,11 @@ _nthm_started (err)
 	  // creating it.
 {
 
-  if (deadlocked ? 1 : pthread_mutex_lock (&starter_lock) ? (deadlocked = IER(323)) : 0)
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->starter_lock)) ? (deadlocked = IER(323)) : 0)
 	 return 0;
-  while (deadlocked ? 0 : starters ? 0 : ! (pthread_cond_wait (&started, &starter_lock) ? IER(324) : 0));
-  starters -= ! deadlocked;
-  return ! (pthread_mutex_unlock (&starter_lock) ? (deadlocked = IER(325)) : deadlocked);
+  while (deadlocked ? 0 : r->starters ? 0 : ! (pthread_cond_wait (&(r->started), &(r->starter_lock)) ? IER(324) : 0));
+  r->starters -= ! deadlocked;
+  return ! (pthread_mutex_unlock (&(r->starter_lock)) ? (deadlocked = IER(325)) : deadlocked);
 }
 
 
@@ -346,14 +300,17 @@ _nthm_started (err)
 
 
 void
-_nthm_relay_race (err)
+_nthm_relay_race (r, err)
+	  nthm_runtime r;
 	  int *err;
 
 	  // Join with previous threads until they're all finished or
 	  // there's a lull. Then schedule the current thread to be joined
 	  // with the next one to finish, and wait for its signal before
 	  // exiting. If the current thread is the last one running, then
-	  // signal the exit routine to join with it instead. This waiting
+	  // signal the exit routine to join with it instead. The signal is
+	  // also broadcast when one is left running, in case that one is
+	  // waiting for the others in nthm_shutdown. This waiting
 	  // doesn't block the user code in the current thread because it
 	  // yielded before this function was called.
 {
@@ -361,27 +318,27 @@ _nthm_relay_race (err)
   pthread_t f;
 
   leak = NULL;
-  if (deadlocked ? 1 : pthread_mutex_lock (&runner_lock) ? (deadlocked = IER(326)) : 0)
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->runner_lock)) ? (deadlocked = IER(326)) : 0)
 	 return;
-  while (finishers ? finishers-- : 0)
+  while (r->finishers ? r->finishers-- : 0)
 	 {
-		f = finishing_thread;
-		if (pthread_cond_signal (&finished) ? (deadlocked = IER(327)) : 0)
+		f = r->finishing_thread;
+		if (pthread_cond_signal (&(r->finished)) ? (deadlocked = IER(327)) : 0)
 		  goto a;
-		if ((pthread_mutex_unlock (&runner_lock) ? 1 : pthread_join (f, &leak)) ? (deadlocked = IER(328)) : 0)
+		if ((pthread_mutex_unlock (&(r->runner_lock)) ? 1 : pthread_join (f, &leak)) ? (deadlocked = IER(328)) : 0)
 		  return;
 		if (leak)
 		  IER(329);
-		if (deadlocked ? 1 : pthread_mutex_lock (&runner_lock) ? (deadlocked = IER(330)) : 0)
+		if (deadlocked ? 1 : pthread_mutex_lock (&(r->runner_lock)) ? (deadlocked = IER(330)) : 0)
 		  return;
 	 }
-  finishers++;
-  finishing_thread = pthread_self ();
-  if ((! runners) ? (deadlocked = IER(331)) : --runners ? 0 : pthread_cond_signal (&last_runner) ? (deadlocked = IER(332)) : 0)
+  r->finishers++;
+  r->finishing_thread = pthread_self ();
+  if ((! r->runners) ? (deadlocked = IER(331)) : (--r->runners > 1) ? 0 : pthread_cond_broadcast (&(r->last_runner)) ? (deadlocked = IER(332)) : 0)
 	 goto a;
-  if (deadlocked ? 1 : pthread_cond_wait (&finished, &runner_lock) ? IER(333) : 0)
+  if (deadlocked ? 1 : pthread_cond_wait (&(r->finished), &(r->runner_lock)) ? IER(333) : 0)
 	 deadlocked = 1;
- a: if (pthread_mutex_unlock (&runner_lock) ? IER(334) : 0)
+ a: if (pthread_mutex_unlock (&(r->runner_lock)) ? IER(334) : 0)
 	 deadlocked = 1;
 }
 
@@ -392,31 +349,265 @@ _nthm_relay_race (err)
 
 
 
+uintptr_t
+_nthm_runners_awaited (r, floor, deadline, err)
+	  nthm_runtime r;
+	  uintptr_t floor;
+	  const struct timespec *deadline;
+	  int *err;
+
+	  // Wait until no more than floor threads are still running or
+	  // until the deadline passes, whichever comes first, and return
+	  // the number still running. The floor is at most one, because
+	  // that's the most for which relay race signals. A null deadline
+	  // means not waiting at all. Unlike _nthm_synchronize, this
+	  // function joins with nothing, so the signal it consumes is
+	  // broadcast to any other waiters anyway.
+{
+  uintptr_t n;
+  int e;
+
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->runner_lock)) ? (deadlocked = IER(447)) : 0)
+	 return 0;
+  for (e = 0; (deadline ? (e != ETIMEDOUT) : 0) ? (r->runners > floor) : 0;)
+	 if ((e = pthread_cond_timedwait (&(r->last_runner), &(r->runner_lock), deadline)) ? (e == ETIMEDOUT ? 0 : IER(448)) : 0)
+		{
+		  deadlocked = 1;
+		  break;
+		}
+  n = r->runners;
+  if (pthread_mutex_unlock (&(r->runner_lock)) ? IER(449) : 0)
+	 deadlocked = 1;
+  return n;
+}
+
+
+
+
+
+
+
+
 void
-_nthm_synchronize (err)
+_nthm_synchronize (r, err)
+	  nthm_runtime r;
 	  int *err;
 
 	  // Join with the last thread still running, if any. This function
 	  // is called only by the exit routine _nthm_close_sync but may
-	  // also be called indirectly from user code through
-	  // nthm_syncrhonize in the public API.
+	  // also be called indirectly from user code through nthm_sync in
+	  // the public API, possibly more than once, so the last thread
+	  // has to be taken off the finishers after being joined.
 {
   void *leak;
 
   leak = NULL;
-  if (deadlocked ? 1 : pthread_mutex_lock (&runner_lock) ? (deadlocked = IER(335)) : 0)
+  if (deadlocked ? 1 : pthread_mutex_lock (&(r->runner_lock)) ? (deadlocked = IER(335)) : 0)
 	 return;
-  if (starting ? 0 : pthread_mutex_unlock (&runner_lock) ? (deadlocked = IER(336)) : 1)
+  if (r->starting ? 0 : pthread_mutex_unlock (&(r->runner_lock)) ? (deadlocked = IER(336)) : 1)
 	 return;
-  starting = 0;
-  if (deadlocked ? 1 : (! runners) ? 0 : pthread_cond_wait (&last_runner, &runner_lock) ? IER(337) : 0)
+  r->starting = 0;
+  while (deadlocked ? 0 : ! ! r->runners)
+	 if (pthread_cond_wait (&(r->last_runner), &(r->runner_lock)) ? IER(337) : 0)
+		deadlocked = 1;
+  if (deadlocked ? 0 : r->finishers ? 0 : IER(361))
 	 deadlocked = 1;
-  if (pthread_cond_signal (&finished) ? IER(338) : 0)
+  else if (r->finishers)
+	 r->finishers--;
+  if (pthread_cond_signal (&(r->finished)) ? IER(338) : 0)
 	 deadlocked = 1;
-  if (pthread_mutex_unlock (&runner_lock) ? IER(339) : 0)
+  if (pthread_mutex_unlock (&(r->runner_lock)) ? IER(339) : 0)
 	 deadlocked = 1;
-  if (pthread_join (finishing_thread, &leak) ? IER(340) : 0)
+  if (pthread_join (r->finishing_thread, &leak) ? IER(340) : 0)
 	 deadlocked = 1;
   if (leak)
 	 IER(341);
 }
+
+
+
+
+
+
+
+
+
+// --------------- thread limiting -------------------------------------------------------------------------
+
+
+
+
+
+
+
+
+int
+_nthm_queued (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Return non-zero if a newly opened source has been put on the
+	  // queue of its runtime to wait for a thread rather than having
+	  // one created for it, which happens when the runtime has a
+	  // thread limit and that many threads are already active.
+	  // Otherwise, if there's a limit, count the thread about to be
+	  // created as active. With no limit, no lock is needed. The
+	  // source holds the complement of its entry in the queue so that
+	  // it can be taken off from anywhere in it.
+{
+  pipe_list u, t;
+  nthm_runtime r;
+  int q;
+
+  q = 0;
+  if ((! source) ? IER(477) : (source->valid != MAGIC) ? IER(478) : (r = source->runtime) ? 0 : IER(479))
+	 return 0;
+  if (! __atomic_load_n (&(r->limit), __ATOMIC_RELAXED))
+	 return 0;
+  if (pthread_mutex_lock (&(r->queue_lock)) ? IER(480) : 0)
+	 return 0;
+  if (! (r->limit))
+	 goto a;
+  if (r->active < r->limit)
+	 {
+		source->limited = ! ! ++(r->active);
+		goto a;
+	 }
+  if (! _nthm_new_complementary_pipe_lists (&u, source, &t, source, err))
+	 goto a;
+  if (_nthm_pushed (u, &(source->queued), err) ? 0 : _nthm_bilaterally_freed (u, t, err) ? 1 : IER(481))
+	 goto a;
+  if (! (q = _nthm_enqueued (t, &(r->queue), &(r->queue_tail), err)))
+	 if (!(_nthm_freed (t, err) ? _nthm_unilaterally_delisted (&(source->queued), err) : NULL))
+		source->valid = MUGGLE(153);
+ a: return ((pthread_mutex_unlock (&(r->queue_lock)) ? IER(482) : 0) ? 0 : q);
+}
+
+
+
+
+
+
+
+
+
+void
+_nthm_unstarted (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Stop counting a thread as active if it was counted but couldn't
+	  // be created.
+{
+  nthm_runtime r;
+
+  if ((! source) ? IER(483) : (source->valid != MAGIC) ? IER(484) : ! (source->limited))
+	 return;
+  if (((r = source->runtime) ? 0 : IER(485)) ? 1 : pthread_mutex_lock (&(r->queue_lock)) ? IER(486) : 0)
+	 return;
+  if (r->active ? 1 : ! IER(487))
+	 r->active--;
+  source->limited = 0;
+  if (pthread_mutex_unlock (&(r->queue_lock)))
+	 IER(488);
+}
+
+
+
+
+
+
+
+
+
+nthm_pipe
+_nthm_next_queued (r, err)
+	  nthm_runtime r;
+	  int *err;
+
+	  // Take the next pipe off the queue of a runtime for the current
+	  // thread to run after its previous one, or if there isn't one,
+	  // stop counting the current thread as active and return NULL.
+	  // This function is called only by threads that are counted, and
+	  // the queue is never left non-empty while none are.
+{
+  nthm_pipe s;
+
+  s = NULL;
+  if ((! r) ? IER(489) : pthread_mutex_lock (&(r->queue_lock)) ? IER(490) : 0)
+	 return NULL;
+  if ((s = _nthm_dequeued (&(r->queue), &(r->queue_tail), err)) ? 0 : r->active ? 1 : ! IER(491))
+	 r->active--;
+  return ((pthread_mutex_unlock (&(r->queue_lock)) ? IER(492) : 0) ? NULL : s);
+}
+
+
+
+
+
+
+
+
+
+int
+_nthm_claimed (source, err)
+	  nthm_pipe source;
+	  int *err;
+
+	  // Return non-zero if a source was waiting in the queue of its
+	  // runtime for a thread, after taking it off the queue so that
+	  // the current thread can run it instead. The queue is checked
+	  // without locking first because it's usually empty.
+{
+  nthm_runtime r;
+  int c;
+
+  c = 0;
+  if ((! source) ? IER(493) : (source->valid != MAGIC) ? IER(494) : (r = source->runtime) ? 0 : IER(495))
+	 return 0;
+  if (! __atomic_load_n (&(r->queue), __ATOMIC_RELAXED))
+	 return 0;
+  if (pthread_mutex_lock (&(r->queue_lock)) ? IER(496) : 0)
+	 return 0;
+  if (source->queued)
+	 c = ((_nthm_bilaterally_dequeued (source->queued, &(r->queue), &(r->queue_tail), err) == source) ? 1 : ! IER(497));
+  return ((pthread_mutex_unlock (&(r->queue_lock)) ? IER(498) : 0) ? 0 : c);
+}
+
+
+
+
+
+
+
+
+
+nthm_pipe
+_nthm_claimed_blocker (d, err)
+	  nthm_pipe d;
+	  int *err;
+
+	  // Take the first of the blockers in the current scope of a
+	  // locked drain d that's waiting in the queue of its runtime off
+	  // the queue and return it, so that the drain's thread can run
+	  // it rather than sleeping, or return NULL if there is none.
+{
+  nthm_runtime r;
+  pipe_list b;
+  nthm_pipe s;
+
+  s = NULL;
+  if ((! d) ? IER(499) : (d->valid != MAGIC) ? IER(500) : (r = d->runtime) ? 0 : IER(501))
+	 return NULL;
+  if ((d->scope ? 0 : IER(502)) ? 1 : ! __atomic_load_n (&(r->queue), __ATOMIC_RELAXED))
+	 return NULL;
+  if (pthread_mutex_lock (&(r->queue_lock)) ? IER(503) : 0)
+	 return NULL;
+  for (b = d->scope->blockers; b ? ! (b->pipe->queued) : 0; b = b->next_pipe);
+  if (b ? ((s = _nthm_bilaterally_dequeued (b->pipe->queued, &(r->queue), &(r->queue_tail), err)) != b->pipe) : 0)
+	 {
+		IER(504);
+		s = NULL;
+	 }
+  return ((pthread_mutex_unlock (&(r->queue_lock)) ? IER(505) : 0) ? NULL : s);
+}
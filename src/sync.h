@@ -27,53 +27,68 @@
 #define PTHREAD_STACK_MIN 65536
 #endif
 
-typedef struct thread_spec_struct *thread_spec;    // passed to the function used to start threads
-
-struct thread_spec_struct
-{
-  nthm_pipe pipe;
-  int write_only;
-  nthm_worker operator;
-  nthm_slacker mutator;
-  void *operand;
-};
-
 // --------------- memory management -----------------------------------------------------------------------
 
-// initialize static storage
+// initialize the thread synchronization fields of a runtime
 extern int
-_nthm_open_sync (int *err);
+_nthm_open_sync (nthm_runtime r, int *err);
 
 // initialize the attributes for all created threads
 extern int
 _nthm_stack_limited_thread_type (pthread_attr_t *a, int *err);
 
-// return a newly allocated and initialized thread_spec
-extern thread_spec
-_nthm_thread_spec_of (nthm_pipe source, nthm_worker operator, nthm_slacker mutator, void *operand, int write_only, int *err);
+// store the parameters of a thread about to be created in its pipe
+extern nthm_pipe
+_nthm_specified (nthm_pipe source, nthm_runtime runtime, nthm_worker operator, nthm_slacker mutator, void *operand, int write_only, int *err);
 
-// free a thread spec
-extern void
-_nthm_unspecify (thread_spec t, int *err);
+// make the operand of a thread about to be created a copy of the given one owned by its pipe
+extern nthm_pipe
+_nthm_copied (nthm_pipe source, const void *original, size_t size, int *err);
 
 // --------------- thread synchronization ------------------------------------------------------------------
 
 // bump the count of running threads, returning non-zero if successful
 extern int
-_nthm_registered (int *err);
+_nthm_registered (nthm_runtime r, int *err);
 
 // safely check whether a thread has started
 extern int
-_nthm_started (int *err);
+_nthm_started (nthm_runtime r, int *err);
 
 // queue the current thread to be joined
 extern void
-_nthm_relay_race (int *err);
+_nthm_relay_race (nthm_runtime r, int *err);
+
+// wait until at most a given number of threads are running or a deadline passes, and return the number running
+extern uintptr_t
+_nthm_runners_awaited (nthm_runtime r, uintptr_t floor, const struct timespec *deadline, int *err);
 
 // block until all running threads have yielded
 extern void
-_nthm_synchronize (int *err);
+_nthm_synchronize (nthm_runtime r, int *err);
 
-// wait for the last thread to finish and report errors on stderr
+// wait for the last thread in a runtime to finish and free its pthread resources
 extern void
-_nthm_close_sync (void);
+_nthm_close_sync (nthm_runtime r, int *err);
+
+// --------------- thread limiting -------------------------------------------------------------------------
+
+// queue a newly opened source to wait for a thread if its runtime's limit is reached, or count its thread
+extern int
+_nthm_queued (nthm_pipe source, int *err);
+
+// stop counting a thread that couldn't be created
+extern void
+_nthm_unstarted (nthm_pipe source, int *err);
+
+// take the next pipe for the current thread to run off the queue, or stop counting the thread
+extern nthm_pipe
+_nthm_next_queued (nthm_runtime r, int *err);
+
+// take a source off the queue so that the current thread can run it, returning non-zero if it was there
+extern int
+_nthm_claimed (nthm_pipe source, int *err);
+
+// take the first queued blocker in the current scope of a locked drain off the queue and return it
+extern nthm_pipe
+_nthm_claimed_blocker (nthm_pipe d, int *err);
@@ -0,0 +1,182 @@
+// test that all storage allocated by nthm goes through an allocator supplied by the application
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include "testconfig.h"
+
+// number of threads to create
+#define CONCURRENCY 32
+
+// number of nested scopes entered by each thread, enough to grow its scope stack
+#define DEPTH 16
+
+// size of an operand too large to be copied into a pipe
+#define BULK 256
+
+// number of allocations made and not yet freed
+uintptr_t global_outstanding = 0;
+
+// number of bytes allocated and not yet freed
+uintptr_t global_bytes = 0;
+
+// total number of allocations
+uintptr_t global_allocations = 0;
+
+// number of allocations that weren't suitably aligned
+uintptr_t global_misaligned = 0;
+
+// used for mutually exclusive access to the counts
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// passed to the allocator as its context
+int global_context = 0;
+
+
+
+
+void *
+allocated (size, alignment, context)
+	  size_t size;
+	  size_t alignment;
+	  void *context;
+
+	  // Allocate storage and count it.
+{
+  void *item;
+
+  if (context != &global_context)
+	 return NULL;
+  if (posix_memalign (&item, (alignment < sizeof (void *)) ? sizeof (void *) : alignment, size))
+	 return NULL;
+  pthread_mutex_lock (&global_lock);
+  global_outstanding++;
+  global_allocations++;
+  global_bytes += size;
+  global_misaligned += ! ! ((uintptr_t) item & (alignment - 1));
+  pthread_mutex_unlock (&global_lock);
+  return item;
+}
+
+
+
+
+
+
+void
+released (item, size, context)
+	  void *item;
+	  size_t size;
+	  void *context;
+
+	  // Free storage and count it.
+{
+  free (item);
+  pthread_mutex_lock (&global_lock);
+  global_outstanding--;
+  global_bytes -= size;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+depth (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Enter and exit nested scopes, opening a thread in the
+	  // innermost one, and then return the first byte of the operand.
+{
+  nthm_pipe source;
+  uintptr_t i;
+
+  for (i = 0; *err ? 0 : (i < DEPTH); i++)
+	 nthm_enter_scope (err);
+  if ((source = nthm_open (&depth, NULL, err)) ? 0 : ! operand)
+	 return NULL;
+  nthm_kill (source, err);
+  for (i = 0; *err ? 0 : (i < DEPTH); i++)
+	 nthm_exit_scope (err);
+  return (void *) (uintptr_t) (operand ? *((unsigned char *) operand) : 0);
+}
+
+
+
+
+
+
+void
+verified ()
+
+	  // Check the counts after the exit routine installed by nthm has
+	  // run. Registered before nthm is initialized, so it runs
+	  // afterwards.
+{
+  if (global_allocations ? (global_outstanding ? 0 : global_bytes ? 0 : ! global_misaligned) : 0)
+	 {
+		printf ("allocator detected no errors\n");
+		return;
+	 }
+  printf ("allocator failed with %lu of %lu allocations outstanding, %lu bytes outstanding, and %lu misaligned\n",
+			 (unsigned long) global_outstanding, (unsigned long) global_allocations, (unsigned long) global_bytes, (unsigned long) global_misaligned);
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  struct nthm_config config;
+  unsigned char bulk[BULK];
+  nthm_pipe source[CONCURRENCY];
+  nthm_runtime runtime;
+  uintptr_t i;
+  int err, mismatch, busy;
+
+  err = mismatch = busy = 0;
+  memset (&config, 0, sizeof (config));
+  config.pipes = config.scopes = config.pipe_lists = CONCURRENCY;
+  if (atexit (verified))
+	 goto a;
+  nthm_set_allocator (&allocated, NULL, &global_context, &mismatch);
+  if (! nthm_set_allocator (&allocated, &released, &global_context, &err))
+	 goto a;
+  if (! nthm_init (&config, &err))
+	 goto a;
+  nthm_set_allocator (NULL, NULL, NULL, &busy);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 {
+		memset (bulk, (int) i, sizeof (bulk));
+		source[i] = nthm_open_copy (&depth, bulk, sizeof (bulk), &err);
+	 }
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((uintptr_t) nthm_read (source[i], &err) != i)
+		err = (err ? err : EINVAL);
+  if ((runtime = nthm_runtime_new (&err)))
+	 nthm_runtime_free (runtime, &err);
+  nthm_sync (&err);
+  if (err ? 0 : (mismatch != EINVAL) ? 0 : (busy == EBUSY))
+	 exit (EXIT_SUCCESS);
+ a: if (err)
+	 printf ("allocator failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("allocator failed with %s for a missing deallocator and %s for a late change\n", nthm_strerror (mismatch), nthm_strerror (busy));
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+}
@@ -0,0 +1,261 @@
+// test that storage allocated by nthm_scope_alloc is handed from workers to their readers and freed on exiting the scope
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include "testconfig.h"
+
+// number of threads to create
+#define CONCURRENCY 64
+
+// number of words in each operand
+#define WIDTH 16
+
+// number of words in a result too big to share a chunk
+#define BULK 1024
+
+// allocations at least this big are assumed to be arena chunks
+#define CHUNK 4096
+
+// number of arena chunks allocated and not yet freed
+uintptr_t global_chunks = 0;
+
+// number of arena chunks ever allocated
+uintptr_t global_allocated = 0;
+
+// used for mutually exclusive access to the counts
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+void *
+allocated (size, alignment, context)
+	  size_t size;
+	  size_t alignment;
+	  void *context;
+
+	  // Allocate storage, counting it if it's an arena chunk.
+{
+  void *item;
+
+  if (posix_memalign (&item, (alignment < sizeof (void *)) ? sizeof (void *) : alignment, size))
+	 return NULL;
+  if (size < CHUNK)
+	 return item;
+  pthread_mutex_lock (&global_lock);
+  global_chunks++;
+  global_allocated++;
+  pthread_mutex_unlock (&global_lock);
+  return item;
+}
+
+
+
+
+
+
+void
+released (item, size, context)
+	  void *item;
+	  size_t size;
+	  void *context;
+
+	  // Free storage, counting it if it's an arena chunk.
+{
+  free (item);
+  if (size < CHUNK)
+	 return;
+  pthread_mutex_lock (&global_lock);
+  global_chunks--;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+uintptr_t
+chunks ()
+
+	  // Return the number of arena chunks outstanding.
+{
+  uintptr_t c;
+
+  pthread_mutex_lock (&global_lock);
+  c = global_chunks;
+  pthread_mutex_unlock (&global_lock);
+  return c;
+}
+
+
+
+
+
+
+void *
+summation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the sum of the words in the operand in storage
+	  // allocated from the arena, using a bigger allocation for odd
+	  // operands. A nested scope allocates and discards some scratch
+	  // storage in passing.
+{
+  uintptr_t *words, *scratch, *result;
+  uintptr_t i;
+
+  if (! (words = (uintptr_t *) operand))
+	 return NULL;
+  if (! nthm_enter_scope (err))
+	 return NULL;
+  if ((scratch = (uintptr_t *) nthm_scope_alloc (BULK * sizeof (*scratch), err)))
+	 for (i = 0; i < BULK; i++)
+		scratch[i] = i;
+  nthm_exit_scope (err);
+  if ((result = (uintptr_t *) nthm_scope_alloc (((words[0] & 0x1) ? BULK : 1) * sizeof (*result), err)))
+	 for (*result = i = 0; i < WIDTH; i++)
+		*result += words[i];
+  return (void *) result;
+}
+
+
+
+
+
+
+void *
+abandonment (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Allocate some storage from the arena, wait until killed, and
+	  // then return nothing, leaving the storage to be freed with the
+	  // pipe.
+{
+  if (! nthm_scope_alloc (BULK * sizeof (uintptr_t), err))
+	 return NULL;
+  while (! nthm_killed (err))
+	 sched_yield ();
+  return NULL;
+}
+
+
+
+
+
+
+void
+verified ()
+
+	  // Check that every arena chunk has been freed after the exit
+	  // routine installed by nthm has run. Registered before nthm is
+	  // initialized, so it runs afterwards.
+{
+  if (global_chunks ? 0 : ! ! global_allocated)
+	 {
+		printf ("arena detected no errors\n");
+		return;
+	 }
+  printf ("arena failed with %lu of %lu arena chunks unreclaimed\n", (unsigned long) global_chunks, (unsigned long) global_allocated);
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+}
+
+
+
+
+
+
+int
+unscoped (err)
+	  int *err;
+
+	  // Read a result allocated from the arena of a worker without
+	  // having opened a pipe or entered a scope beforehand, and check
+	  // that it's still intact after another one is read.
+{
+  uintptr_t words[WIDTH];
+  uintptr_t *first, *second;
+  uintptr_t j;
+
+  for (j = 0; j < WIDTH; j++)
+	 words[j] = j;
+  if (! (first = (uintptr_t *) nthm_read (nthm_open (&summation, words, err), err)))
+	 return 0;
+  words[0] = 1;
+  if (! (second = (uintptr_t *) nthm_read (nthm_open (&summation, words, err), err)))
+	 return 0;
+  return ((*first == (WIDTH * (WIDTH - 1)) / 2) ? (*second == *first + 1) : 0);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[CONCURRENCY];
+  uintptr_t *words, *result;
+  uintptr_t i, j, base, held;
+  int err;
+
+  err = 0;
+  words = NULL;
+  if (atexit (verified) ? 1 : ! nthm_set_allocator (&allocated, &released, NULL, &err))
+	 goto a;
+  if (unscoped (&err) ? 0 : (err = (err ? err : EINVAL)))
+	 goto a;
+  base = chunks ();
+  nthm_enter_scope (&err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((words = (uintptr_t *) nthm_scope_alloc (WIDTH * sizeof (*words), &err)))
+		{
+		  for (j = 0; j < WIDTH; j++)
+			 words[j] = i + j;
+		  source[i] = nthm_open (&summation, words, &err);
+		}
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((result = (uintptr_t *) nthm_read (source[i], &err)) ? (*result != WIDTH * i + (WIDTH * (WIDTH - 1)) / 2) : ! err)
+		err = EINVAL;
+  held = chunks ();
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 nthm_open (&abandonment, NULL, &err);
+  nthm_kill_all (&err);
+  nthm_sync (&err);
+  if (err ? 0 : (chunks () != held))
+	 goto c;
+  nthm_exit_scope (&err);
+  if (err ? 0 : (held > base) ? (chunks () != base) : 1)
+	 goto b;
+  if ((words = (uintptr_t *) nthm_scope_alloc (WIDTH * sizeof (*words), &err)))
+	 for (j = 0; j < WIDTH; j++)
+		words[j] = 1;
+  if ((source[0] = nthm_open (&summation, words, &err)))
+	 if ((result = (uintptr_t *) nthm_read (source[0], &err)) ? (*result != WIDTH) : ! err)
+		err = EINVAL;
+  if ((result = (uintptr_t *) nthm_scope_alloc (sizeof (*result), &err)) ? 0 : ! err)
+	 err = EINVAL;
+  if (! err)
+	 exit (EXIT_SUCCESS);
+ a: printf ("arena failed\n%s\n", nthm_strerror (err));
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+ b: printf ("arena failed with %lu arena chunks held in the scope and %lu left after exiting it\n", (unsigned long) (held - base), (unsigned long) (chunks () - base));
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+ c: printf ("arena failed with %lu arena chunks held in the scope and %lu after killing its threads\n", (unsigned long) (held - base), (unsigned long) (chunks () - base));
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+}
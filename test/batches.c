@@ -0,0 +1,68 @@
+// test that finished pipes can be selected and read in batches
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "testconfig.h"
+
+// number of threads to create
+#define CONCURRENCY 256
+
+// maximum number of pipes to select at a time
+#define BATCH 16UL
+
+
+
+
+void *
+successor (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the successor of the operand.
+{
+  return (void *) ((uintptr_t) operand + 1);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[BATCH];
+  void *result[BATCH];
+  uintptr_t i, total, expected, count;
+  size_t n, j;
+  int err;
+
+  err = 0;
+  total = count = 0;
+  expected = (CONCURRENCY * (CONCURRENCY + 1)) >> 1;
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 nthm_open (&successor, (void *) i, &err);
+  while (err ? 0 : (n = nthm_select_many (source, BATCH, &err)))
+	 {
+		nthm_read_many (source, result, n, &err);
+		for (j = 0; j < n; j++)
+		  total += (uintptr_t) result[j];
+		count += n;
+	 }
+  if (err ? 0 : ! n)
+	 nthm_read_many (NULL, NULL, n, &err);
+  if (err ? 0 : (count != CONCURRENCY) ? 0 : (total == expected))
+	 {
+		printf ("batches detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  if (err)
+	 printf ("batches failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("batches failed with %lu of %lu pipes totalling %lu instead of %lu\n", (unsigned long) count, (unsigned long) CONCURRENCY, (unsigned long) total, (unsigned long) expected);
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,272 @@
+// test that nthm_kill_all cancels only the threads in the current scope and wakes blocked readers
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include "testconfig.h"
+
+// number of threads to create in each batch
+#define CONCURRENCY 64
+
+// number of nested scopes to enter while cancelled threads are still running
+#define DEPTH 16
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// number of threads in the enclosing scope that found themselves killed
+uintptr_t global_mistaken = 0;
+
+// number of cancelled threads that have finished
+uintptr_t global_finished = 0;
+
+// set to one when cancelled threads with odd operands may finish and to two when all threads may
+uintptr_t global_released = 0;
+
+// number of cancelled threads whose blocking reads were interrupted
+uintptr_t global_interrupted = 0;
+
+// used for mutually exclusive access to the globals
+pthread_mutex_t global_lock;
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until killed and released, and then return some heap
+	  // allocated storage.
+{
+  uintptr_t *result;
+  uintptr_t released;
+
+  while (! nthm_killed (err))
+	 sched_yield ();
+  do
+	 {
+		pthread_mutex_lock (&global_lock);
+		released = global_released;
+		pthread_mutex_unlock (&global_lock);
+		sched_yield ();
+	 }
+  while (released < (((uintptr_t) operand & 0x1) ? 1 : 2));
+  pthread_mutex_lock (&global_lock);
+  global_finished++;
+  pthread_mutex_unlock (&global_lock);
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void *
+survival (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until released, noting whether killed in the meantime,
+	  // and then return the operand.
+{
+  uintptr_t released;
+
+  do
+	 {
+		if (nthm_killed (err))
+		  {
+			 pthread_mutex_lock (&global_lock);
+			 global_mistaken++;
+			 pthread_mutex_unlock (&global_lock);
+			 break;
+		  }
+		pthread_mutex_lock (&global_lock);
+		released = global_released;
+		pthread_mutex_unlock (&global_lock);
+		sched_yield ();
+	 }
+  while (released < 2);
+  return operand;
+}
+
+
+
+
+
+
+uintptr_t
+counted (count)
+	  uintptr_t *count;
+
+	  // Return the value of a global count.
+{
+  uintptr_t c;
+
+  pthread_mutex_lock (&global_lock);
+  c = *count;
+  pthread_mutex_unlock (&global_lock);
+  return c;
+}
+
+
+
+
+
+
+void
+incremented (count)
+	  uintptr_t *count;
+
+	  // Increment a global count.
+{
+  pthread_mutex_lock (&global_lock);
+  ++*count;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+patience (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until released regardless of being killed.
+{
+  while (counted (&global_released) < 3)
+	 sched_yield ();
+  return operand;
+}
+
+
+
+
+
+
+void *
+obstruction (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Block reading a thread that ignores being killed, and count
+	  // it if the read is interrupted before that thread is released,
+	  // or if it was killed too soon to open the thread.
+{
+  nthm_pipe source;
+
+  if ((source = nthm_open (&patience, operand, err)))
+	 nthm_read (source, err);
+  if (counted (&global_released) < 3)
+	 incremented (&global_interrupted);
+  return operand;
+}
+
+
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[CONCURRENCY];
+  nthm_pipe victim;
+  uintptr_t i, j, mistaken, destroyed;
+  int err;
+
+  err = 0;
+  pthread_mutex_init (&global_lock, NULL);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 source[i] = nthm_open (&survival, (void *) i, &err);
+  nthm_enter_scope (&err);
+  for (j = 0; err ? 0 : (j < 2); j++)
+	 {
+		for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+		  if ((victim = nthm_open (&allocation, (void *) i, &err)))
+			 nthm_set_destructor (victim, &destruction, &err);
+		nthm_kill_all (&err);
+	 }
+  for (j = 0; err ? 0 : (j < DEPTH); j++)
+	 nthm_enter_scope (&err);
+  pthread_mutex_lock (&global_lock);
+  global_released = 1;
+  pthread_mutex_unlock (&global_lock);
+  do
+	 {
+		pthread_mutex_lock (&global_lock);
+		i = global_finished;
+		pthread_mutex_unlock (&global_lock);
+		sched_yield ();
+	 }
+  while (err ? 0 : (i < CONCURRENCY));
+  for (j = 0; err ? 0 : (j < DEPTH); j++)
+	 nthm_exit_scope (&err);
+  nthm_exit_scope (&err);
+  pthread_mutex_lock (&global_lock);
+  global_released = 2;
+  pthread_mutex_unlock (&global_lock);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((uintptr_t) nthm_read (source[i], &err) != i)
+		err = (err ? err : EINVAL);
+  nthm_sync (&err);
+  nthm_enter_scope (&err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 {
+		nthm_open (&obstruction, (void *) i, &err);
+	 }
+  nthm_kill_all (&err);
+  while (err ? 0 : (counted (&global_interrupted) < CONCURRENCY))
+	 sched_yield ();
+  pthread_mutex_lock (&global_lock);
+  global_released = 3;
+  pthread_mutex_unlock (&global_lock);
+  nthm_sync (&err);
+  nthm_exit_scope (&err);
+  pthread_mutex_lock (&global_lock);
+  mistaken = global_mistaken;
+  destroyed = global_destroyed;
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : mistaken ? 0 : (destroyed == 2 * CONCURRENCY))
+	 {
+		printf ("cancel detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  if (err)
+	 printf ("cancel failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("cancel failed with %lu mistaken kills and %lu of %lu results destroyed\n", (unsigned long) mistaken, (unsigned long) destroyed, (unsigned long) (2 * CONCURRENCY));
+  exit (EXIT_FAILURE);
+}
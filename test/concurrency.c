@@ -0,0 +1,178 @@
+// test that a thread limit bounds the number of threads running at once without deadlocking readers
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include "testconfig.h"
+
+// most threads allowed to run at once
+#define LIMIT 4UL
+
+// number of threads opened by each thread that isn't a leaf
+#define FANOUT 4
+
+// number of levels of threads below the first
+#define DEPTH 6
+
+// number of threads sent or left untethered
+#define CONCURRENCY 64
+
+// number of threads currently running user code, counting a thread only once however deeply it's nested
+uintptr_t global_running = 0;
+
+// the most threads ever counted running at once
+uintptr_t global_peak = 0;
+
+// number of sent threads that have run
+uintptr_t global_sent = 0;
+
+// used for mutually exclusive access to the counts
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// number of pipes being run by the current thread, which is more than one if a reader runs one waiting for a thread
+_Thread_local uintptr_t nesting = 0;
+
+
+
+
+void
+entered ()
+
+	  // Count the current thread as running if it isn't already.
+{
+  if (nesting++)
+	 return;
+  pthread_mutex_lock (&global_lock);
+  if (++global_running > global_peak)
+	 global_peak = global_running;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void
+exited ()
+
+	  // Stop counting the current thread as running if it's finished
+	  // with its outermost pipe.
+{
+  if (--nesting)
+	 return;
+  pthread_mutex_lock (&global_lock);
+  global_running--;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+tree (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the number of leaves in a tree of threads of the given
+	  // depth, reading from the children by nthm_read, nthm_select or
+	  // nthm_read_all depending on the depth.
+{
+  nthm_pipe source[FANOUT];
+  void *results[FANOUT];
+  uintptr_t depth, i, n, total;
+
+  entered ();
+  total = 0;
+  if (! (depth = (uintptr_t) operand))
+	 {
+		total = 1;
+		goto a;
+	 }
+  if ((depth % 3 == 2) ? ! nthm_enter_scope (err) : 0)
+	 goto a;
+  for (i = 0; *err ? 0 : (i < FANOUT); i++)
+	 source[i] = nthm_open (&tree, (void *) (depth - 1), err);
+  if (depth % 3 == 0)
+	 for (i = 0; *err ? 0 : (i < FANOUT); i++)
+		total += (uintptr_t) nthm_read (source[i], err);
+  else if (depth % 3 == 1)
+	 for (i = 0; *err ? 0 : (i < FANOUT); i++)
+		total += (uintptr_t) nthm_read (nthm_select (err), err);
+  else
+	 {
+		for (i = 0, n = nthm_read_all (results, NULL, (size_t) FANOUT, err); i < n; i++)
+		  total += (uintptr_t) results[i];
+		nthm_exit_scope (err);
+	 }
+ a: exited ();
+  return (void *) total;
+}
+
+
+
+
+
+
+void
+sent (operand)
+	  void *operand;
+
+	  // Count a sent thread.
+{
+  entered ();
+  pthread_mutex_lock (&global_lock);
+  global_sent++;
+  pthread_mutex_unlock (&global_lock);
+  exited ();
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[CONCURRENCY];
+  uintptr_t i, leaves, expected, peak, count;
+  int err;
+
+  err = 0;
+  nthm_set_concurrency (LIMIT, &err);
+  for (expected = 1, i = 0; i < DEPTH; i++)
+	 expected *= FANOUT;
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 nthm_send (&sent, NULL, &err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((source[i] = nthm_open (&tree, (void *) 1, &err)))
+		nthm_untether (source[i], &err);
+  leaves = (uintptr_t) nthm_read (nthm_open (&tree, (void *) DEPTH, &err), &err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((uintptr_t) nthm_read (source[i], &err) != FANOUT)
+		err = (err ? err : EINVAL);
+  nthm_sync (&err);
+  pthread_mutex_lock (&global_lock);
+  peak = global_peak;
+  count = global_sent;
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : (leaves != expected) ? 0 : (count != CONCURRENCY) ? 0 : (peak <= LIMIT + 1))
+	 {
+		printf ("concurrency detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  if (err)
+	 printf ("concurrency failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("concurrency failed with %lu of %lu leaves, %lu of %lu sent threads, and %lu threads running at once\n",
+				(unsigned long) leaves, (unsigned long) expected, (unsigned long) count, (unsigned long) CONCURRENCY, (unsigned long) peak);
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,91 @@
+// test a deep thread pool whose operands are copied by nthm_open_copy
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include "testconfig.h"
+
+// an interval padded enough not to fit in a pipe, exercising the heap copy
+struct padded_interval_struct
+{
+  struct interval_struct x;
+  unsigned char padding[NTHM_OPERAND_MAX];
+};
+
+
+
+
+uintptr_t
+sum_of_interval (x, err)
+	  interval x;
+	  int *err;
+
+	  // Return the summation over an interval computed sequentially if
+	  // the interval is small and concurrently if it's large. Operands
+	  // are stack allocated by the creator and copied by nthm, with
+	  // alternate levels padded so as to alternate between copies in
+	  // the pipe and on the heap.
+{
+  uintptr_t i, total, start, count;
+  struct padded_interval_struct subinterval;
+  nthm_pipe source;
+  size_t size;
+
+  total = 0;
+  if (!x)
+	 return total;
+  count = (uintptr_t) rand () >> (x->depth >> 1);
+  if ((!count) ? 1 : (x->count <= count))
+	 for (i = x->start; i < x->start + x->count; total += i++);
+  else
+	 {
+		start = x->start;
+		size = ((x->depth & 1) ? sizeof (subinterval) : sizeof (subinterval.x));
+		while (*err ? 0 : start < x->start + x->count)
+		  {
+			 if (start + count > x->start + x->count)
+				count = x->start + x->count - start;
+			 subinterval.x.start = start;
+			 subinterval.x.count = count;
+			 subinterval.x.depth = x->depth + 1;
+			 nthm_open_copy ((nthm_worker) &sum_of_interval, &subinterval, size, err);
+			 start = start + count;
+			 count = (uintptr_t) rand () >> (x->depth >> 1);
+		  }
+		while (*err ? NULL : (source = nthm_select (err)))
+		  total += (uintptr_t) nthm_read (source, err);
+	 }
+  return total;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  int err;
+  struct interval_struct x;
+  unsigned s;
+
+  err = 0;
+  GETRANDOM(s);
+  srand (s);
+  x.depth = 2;
+  x.start = 0;
+  x.count = LAST_TERM;
+  if (sum_of_interval (&x, &err) == EXPECTED_CUMULATIVE_SUM)
+	 {
+		printf ("copypool detected no errors\n");
+		exit(EXIT_SUCCESS);
+	 }
+  printf (err ? "copypool failed with seed 0x%x\n%s\n" : "copypool failed with seed 0x%x\n", s, nthm_strerror(err));
+  exit (EXIT_FAILURE);
+}
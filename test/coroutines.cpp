@@ -0,0 +1,270 @@
+// test typed pipes, RAII handles and coroutine awaitables in the C++ layer
+
+#include <nthm.hpp>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <string>
+#include "testconfig.h"
+
+// number of threads to create for each kind of test
+#define CONCURRENCY 64
+
+// error code reported by a worker that fails on purpose
+#define FAILURE 1
+
+// number of results of a counted type that haven't been destroyed
+static std::atomic<intptr_t> global_live (0);
+
+// coroutines waiting to be resumed by the main thread
+static std::deque<std::coroutine_handle<> > global_ready;
+
+// secures mutually exclusive access to the ready coroutines
+static std::mutex global_lock;
+
+// signaled when a coroutine is made ready
+static std::condition_variable global_posted;
+
+
+
+
+// a result whose constructions and destructions are counted
+struct counted
+{
+  std::string text;
+
+  explicit counted (std::string t) : text (std::move (t))
+  {
+	 global_live++;
+  }
+
+  counted (counted &&other) : text (std::move (other.text))
+  {
+	 global_live++;
+  }
+
+  ~counted ()
+  {
+	 global_live--;
+  }
+};
+
+
+
+
+
+
+// a coroutine that starts eagerly and frees itself when finished
+struct task
+{
+  struct promise_type
+  {
+	 task get_return_object () noexcept { return task (); }
+	 std::suspend_never initial_suspend () noexcept { return {}; }
+	 std::suspend_never final_suspend () noexcept { return {}; }
+	 void return_void () noexcept {}
+	 void unhandled_exception () noexcept { std::terminate (); }
+  };
+};
+
+
+
+
+
+
+static void
+posted (std::coroutine_handle<> waiting, void *context)
+
+	  // Hand a coroutine to the main thread to be resumed.
+{
+  std::lock_guard<std::mutex> hold (global_lock);
+
+  global_ready.push_back (waiting);
+  global_posted.notify_one ();
+}
+
+
+
+
+
+
+static void
+resumed (std::atomic<int> *done)
+
+	  // Resume the coroutines posted to the main thread until done.
+{
+  std::coroutine_handle<> waiting;
+
+  while (! done->load ())
+	 {
+		{
+		  std::unique_lock<std::mutex> hold (global_lock);
+
+		  global_posted.wait (hold, [] { return ! global_ready.empty (); });
+		  waiting = global_ready.front ();
+		  global_ready.pop_front ();
+		}
+		waiting.resume ();
+	 }
+}
+
+
+
+
+
+
+static task
+summed (std::atomic<int> *done, uintptr_t *total, int *err)
+
+	  // Open some pipes and await each of them in turn, resuming in
+	  // the main thread.
+{
+  nthm::resumer main_thread { &posted, nullptr };
+  nthm::pipe<uintptr_t> source[CONCURRENCY];
+  uintptr_t i;
+
+  try
+	 {
+		for (i = 0; i < CONCURRENCY; i++)
+		  source[i] = nthm::open ([i] { return i; });
+		for (i = 0; i < CONCURRENCY; i++)
+		  *total += co_await source[i].on (main_thread);
+	 }
+  catch (nthm::error &e)
+	 {
+		*err = e.code ();
+	 }
+  *done = 1;
+}
+
+
+
+
+
+
+static task
+unresumed (int *err)
+
+	  // Await a pipe without saying where to resume, which is an
+	  // error reported before the coroutine is suspended.
+{
+  nthm::pipe<uintptr_t> source = nthm::open ([] { return (uintptr_t) 0; });
+
+  try
+	 {
+		co_await source.on (nthm::resumer ());
+	 }
+  catch (nthm::error &e)
+	 {
+		*err = e.code ();
+	 }
+}
+
+
+
+
+
+
+static task
+selected (std::atomic<int> *done, uintptr_t *total, int *err)
+
+	  // Open some pipes in a scope and await each of them as they
+	  // finish, resuming in the main thread.
+{
+  nthm::resumer main_thread { &posted, nullptr };
+  uintptr_t i;
+
+  try
+	 {
+		nthm::scope s;
+
+		for (i = 0; i < CONCURRENCY; i++)
+		  nthm::open ([i] { return i; }).release ();
+		for (i = 0; i < CONCURRENCY; i++)
+		  *total += (co_await nthm::next<uintptr_t> (main_thread)).read ();
+	 }
+  catch (nthm::error &e)
+	 {
+		*err = e.code ();
+	 }
+  *done = 1;
+}
+
+
+
+
+
+
+int
+main (int argc, char **argv)
+{
+  std::atomic<int> done (0);
+  uintptr_t i, total;
+  int err;
+
+  err = 0;
+  total = 0;
+  try
+	 {
+		// unboxed results and copied workers
+		if (nthm::open ([] { return (uintptr_t) 42; }).read () != 42)
+		  throw nthm::error (EINVAL);
+		// boxed results and workers moved to the heap
+		if (nthm::open ([t = std::string (NTHM_OPERAND_MAX, 'x')] { return counted (t); }).read ().text.size () != NTHM_OPERAND_MAX)
+		  throw nthm::error (EINVAL);
+		// results discarded by the destructor or read with the join policy
+		for (i = 0; i < CONCURRENCY; i++)
+		  {
+			 nthm::pipe<counted> killed = nthm::open ([] { return counted ("killed"); });
+			 nthm::pipe<counted> joined = nthm::open ([] { return counted ("joined"); });
+
+			 joined.set_policy (NTHM_JOIN);
+		  }
+		// errors reported by workers
+		try
+		  {
+			 nthm::open ([] (int *e) { *e = FAILURE; }).read ();
+			 throw nthm::error (EINVAL);
+		  }
+		catch (nthm::error &e)
+		  {
+			 if (e.code () != FAILURE)
+				throw;
+		  }
+		unresumed (&err);
+		if (err != EINVAL)
+		  throw nthm::error (EINVAL);
+		err = 0;
+		summed (&done, &total, &err);
+		resumed (&done);
+		if (err ? 0 : (total != CONCURRENCY * (CONCURRENCY - 1) / 2))
+		  throw nthm::error (EINVAL);
+		done = 0;
+		total = 0;
+		selected (&done, &total, &err);
+		resumed (&done);
+		if (err ? 0 : (total != CONCURRENCY * (CONCURRENCY - 1) / 2))
+		  throw nthm::error (EINVAL);
+	 }
+  catch (nthm::error &e)
+	 {
+		err = (err ? err : e.code ());
+	 }
+  nthm_sync (&err);
+  if (err ? 0 : ! global_live)
+	 {
+		printf ("coroutines detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  if (err)
+	 printf ("coroutines failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("coroutines failed with %ld results not destroyed\n", (long) global_live.load ());
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,163 @@
+// test that threads left running and unread at exit are killed and reclaimed
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include "testconfig.h"
+
+// number of threads of each kind to create
+#define CONCURRENCY 32
+
+// number of threads tethered to each thread that blocks
+#define FANOUT 4
+
+// seconds to wait for the exit routine before concluding that it hangs
+#define PATIENCE 60
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// number of threads opened by threads that block
+uintptr_t global_opened = 0;
+
+// used for mutually exclusive access to the counts
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until killed and then return some heap allocated storage.
+{
+  uintptr_t *result;
+
+  while (! nthm_killed (err))
+	 sched_yield ();
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void *
+blockage (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Open some threads that wait until killed and block reading
+	  // from one of them, relying on being woken when killed. Opening
+	  // fails if this thread is killed first, so the threads that are
+	  // opened with a destructor are counted. The one being read may
+	  // finish before the read is interrupted, in which case its
+	  // result is destroyed here.
+{
+  nthm_pipe source[FANOUT];
+  uintptr_t i;
+  void *result;
+
+  for (i = 0; *err ? 0 : (i < FANOUT); i++)
+	 if ((source[i] = nthm_open (&allocation, (void *) i, err)))
+		{
+		  nthm_set_destructor (source[i], &destruction, err);
+		  if (*err)
+			 break;
+		  pthread_mutex_lock (&global_lock);
+		  global_opened++;
+		  pthread_mutex_unlock (&global_lock);
+		}
+  if (*err ? 0 : ! ! (result = nthm_read (source[0], err)))
+	 destruction (result);
+  return allocation (operand, err);
+}
+
+
+
+
+
+
+void
+verified ()
+
+	  // Check the count of destroyed results after the exit routine
+	  // installed by nthm has run. Registered before nthm is
+	  // initialized, so it runs afterwards.
+{
+  uintptr_t expected;
+
+  expected = 3 * CONCURRENCY + global_opened;
+  if (global_destroyed == expected)
+	 {
+		printf ("exeunt detected no errors\n");
+		return;
+	 }
+  printf ("exeunt failed with %lu of %lu results destroyed\n", (unsigned long) global_destroyed, (unsigned long) expected);
+  fflush (stdout);
+  _exit (EXIT_FAILURE);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source;
+  uintptr_t i;
+  int err;
+
+  err = 0;
+  if (atexit (verified) ? 1 : ! nthm_init (NULL, &err))
+	 goto a;
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 {
+		if ((source = nthm_open (&allocation, (void *) i, &err)))
+		  nthm_set_destructor (source, &destruction, &err);
+		if ((source = nthm_open (&allocation, (void *) i, &err)))
+		  nthm_set_destructor (source, &destruction, &err);
+		nthm_untether (source, &err);
+		if ((source = nthm_open (&blockage, (void *) i, &err)))
+		  nthm_set_destructor (source, &destruction, &err);
+	 }
+  if (err)
+	 goto a;
+  alarm (PATIENCE);
+  exit (EXIT_SUCCESS);
+ a: printf (err ? "exeunt failed\n%s\n" : "exeunt failed\n", nthm_strerror (err));
+  _exit (EXIT_FAILURE);
+}
@@ -0,0 +1,82 @@
+// test that all threads in a scope can be joined at once with their error codes
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "testconfig.h"
+
+// number of threads to create in the inner scope
+#define CONCURRENCY 128UL
+
+// number of threads to create in the outer scope
+#define OUTLIERS 16UL
+
+// error code reported by some of the threads
+#define FAILURE 1
+
+
+
+
+void *
+successor (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the successor of the operand, and report an error for
+	  // every multiple of three.
+{
+  uintptr_t x;
+
+  x = (uintptr_t) operand;
+  if (! (x % 3))
+	 *err = FAILURE;
+  return (void *) (x + 1);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  void *result[CONCURRENCY];
+  int status[CONCURRENCY];
+  uintptr_t i, total, failures, outer, expected;
+  size_t n, j;
+  int err;
+
+  err = 0;
+  total = failures = outer = 0;
+  expected = (CONCURRENCY * (CONCURRENCY + 1)) >> 1;
+  for (i = 0; err ? 0 : (i < OUTLIERS); i++)
+	 nthm_open (&successor, (void *) (i + 1), &err);
+  nthm_enter_scope (&err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 nthm_open (&successor, (void *) i, &err);
+  while (err ? 0 : (n = nthm_read_all (result, status, CONCURRENCY / 3, &err)))
+	 for (j = 0; j < n; j++)
+		{
+		  total += (uintptr_t) result[j];
+		  failures += (status[j] == FAILURE);
+		}
+  nthm_exit_scope (&err);
+  if ((n = (err ? 0 : nthm_read_all (result, status, CONCURRENCY, &err))) != OUTLIERS)
+	 goto a;
+  for (j = 0; j < n; j++)
+	 outer += ! status[j];
+  if (err ? 0 : (outer != OUTLIERS - OUTLIERS / 3) ? 0 : (failures != (CONCURRENCY + 2) / 3) ? 0 : (total == expected))
+	 {
+		printf ("joinall detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+ a: if (err)
+	 printf ("joinall failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("joinall failed with a total of %lu instead of %lu and %lu failures\n", (unsigned long) total, (unsigned long) expected, (unsigned long) failures);
+  exit (EXIT_FAILURE);
+}
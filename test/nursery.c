@@ -0,0 +1,135 @@
+// test that threads left in a scope by nthm_scope_run are joined or killed
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include "testconfig.h"
+
+// number of threads to create in each scope
+#define CONCURRENCY 64
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// used for mutually exclusive access to the count
+pthread_mutex_t global_lock;
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return some heap allocated storage, first waiting until killed
+	  // if the operand is non-zero.
+{
+  uintptr_t *result;
+
+  if (operand)
+	 while (! nthm_killed (err))
+		sched_yield ();
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+spawner (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Open some threads and leave them unread, returning the number
+	  // opened.
+{
+  nthm_pipe source;
+  uintptr_t i;
+
+  for (i = 0; *err ? 0 : (i < CONCURRENCY); i++)
+	 if ((source = nthm_open ((nthm_worker) &allocation, operand, err)))
+		nthm_set_destructor (source, &destruction, err);
+  return (void *) i;
+}
+
+
+
+
+
+
+static uintptr_t
+destroyed ()
+
+	  // Return the number of results destroyed so far.
+{
+  uintptr_t d;
+
+  pthread_mutex_lock (&global_lock);
+  d = global_destroyed;
+  pthread_mutex_unlock (&global_lock);
+  return d;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  uintptr_t joined, killed;
+  int err;
+
+  err = 0;
+  killed = 0;
+  pthread_mutex_init (&global_lock, NULL);
+  if ((joined = (uintptr_t) nthm_scope_run (&spawner, NULL, NTHM_JOIN, &err)) != CONCURRENCY)
+	 goto a;
+  if ((joined = destroyed ()) != CONCURRENCY)
+	 goto a;
+  if ((uintptr_t) nthm_scope_run (&spawner, (void *) 1, NTHM_KILL, &err) != CONCURRENCY)
+	 goto a;
+  nthm_sync (&err);
+  killed = destroyed () - joined;
+  if (err ? 0 : (killed == CONCURRENCY))
+	 {
+		printf ("nursery detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+ a: if (err)
+	 printf ("nursery failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("nursery failed with %lu joined and %lu killed of %lu each\n", (unsigned long) joined, (unsigned long) killed, (unsigned long) CONCURRENCY);
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,102 @@
+// test that the results of killed threads are passed to their destructors
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include "testconfig.h"
+
+// number of threads to create
+#define CONCURRENCY 64
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// used for mutually exclusive access to the count
+pthread_mutex_t global_lock;
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return some heap allocated storage, sometimes waiting a while
+	  // before returning so that some threads are killed before they
+	  // yield and others after.
+{
+  uintptr_t *result;
+  uintptr_t i, total;
+
+  if ((uintptr_t) operand & 0x1)
+	 for (total = i = 0; (i < 0xfffff) ? ! nthm_killed (err) : 0; total += i++);
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[CONCURRENCY];
+  uintptr_t i, read;
+  void *result;
+  int err;
+
+  err = 0;
+  read = 0;
+  pthread_mutex_init (&global_lock, NULL);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if (i & 0x2)
+		source[i] = nthm_open_with_destructor ((nthm_worker) &allocation, (void *) i, &destruction, &err);
+	 else if ((source[i] = nthm_open ((nthm_worker) &allocation, (void *) i, &err)))
+		nthm_set_destructor (source[i], &destruction, &err);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i += 4, read++)
+	 if ((result = nthm_read (source[i], &err)))
+		free (result);
+  nthm_kill_all (&err);
+  nthm_sync (&err);
+  pthread_mutex_lock (&global_lock);
+  i = global_destroyed;
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : (i == CONCURRENCY - read))
+	 {
+		printf ("reclaim detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  if (err)
+	 printf ("reclaim failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("reclaim failed with %lu of %lu results destroyed\n", (unsigned long) i, (unsigned long) (CONCURRENCY - read));
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,57 @@
+// test that nthm_sync can be called repeatedly with threads created in between
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "testconfig.h"
+
+// number of threads to create between synchronizations
+#define CONCURRENCY 64
+
+// number of times to synchronize
+#define ROUNDS 8
+
+
+
+
+void *
+identity (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the operand.
+{
+  return operand;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source;
+  uintptr_t i, j;
+  int err;
+
+  err = 0;
+  for (j = 0; err ? 0 : (j < ROUNDS); j++)
+	 {
+		for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+		  if ((source = nthm_open (&identity, (void *) i, &err)))
+			 nthm_untether (source, &err);
+		nthm_sync (&err);
+	 }
+  if (! err)
+	 {
+		printf ("resync detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+  printf ("resync failed\n%s\n", nthm_strerror (err));
+  exit (EXIT_FAILURE);
+}
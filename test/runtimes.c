@@ -0,0 +1,157 @@
+// test that threads in separate runtimes are synchronized and reclaimed independently
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include "testconfig.h"
+
+// number of threads to create in each runtime
+#define CONCURRENCY 32
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// used for mutually exclusive access to the count
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+identity (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Return the operand.
+{
+  return operand;
+}
+
+
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until killed and then return some heap allocated storage.
+{
+  uintptr_t *result;
+
+  while (! nthm_killed (err))
+	 sched_yield ();
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void *
+bystander (err_pointer)
+	  void *err_pointer;
+
+	  // Run in an unmanaged thread using the default runtime, opening
+	  // and reading some threads and synchronizing with all threads in
+	  // the default runtime, which mustn't wait for those left running
+	  // in the other one. Return an untethered pipe to be read by the
+	  // main thread.
+{
+  nthm_pipe source;
+  uintptr_t i;
+  int *err;
+
+  err = (int *) err_pointer;
+  for (i = 0; *err ? 0 : (i < CONCURRENCY); i++)
+	 if ((source = nthm_open (&identity, (void *) i, err)) ? ((uintptr_t) nthm_read (source, err) != i) : 0)
+		*err = (*err ? *err : EINVAL);
+  nthm_sync (err);
+  if ((source = nthm_open (&identity, (void *) CONCURRENCY, err)))
+	 nthm_untether (source, err);
+  return (void *) source;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_runtime runtime;
+  nthm_pipe source;
+  pthread_t bystanding;
+  uintptr_t i, destroyed;
+  int err, mismatch, busy;
+
+  err = busy = mismatch = 0;
+  destroyed = 0;
+  if (! (runtime = nthm_runtime_new (&err)))
+	 goto a;
+  if (nthm_runtime_select (runtime, &err) ? (err = (err ? err : EINVAL)) : err)
+	 goto a;
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((source = nthm_open (&allocation, (void *) i, &err)))
+		nthm_set_destructor (source, &destruction, &err);
+  if (err)
+	 goto a;
+  nthm_runtime_select (NULL, &busy);
+  if (pthread_create (&bystanding, NULL, &bystander, &err) ? 1 : pthread_join (bystanding, (void **) &source))
+	 goto a;
+  if (err)
+	 goto a;
+  nthm_tether (source, &mismatch);
+  if ((uintptr_t) nthm_read (source, &err) != CONCURRENCY)
+	 err = (err ? err : EINVAL);
+  nthm_runtime_free (runtime, &err);
+  if ((source = nthm_open (&identity, (void *) CONCURRENCY, &err)))
+	 if ((uintptr_t) nthm_read (source, &err) != CONCURRENCY)
+		err = (err ? err : EINVAL);
+  nthm_sync (&err);
+  pthread_mutex_lock (&global_lock);
+  destroyed = global_destroyed;
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : (busy != EBUSY) ? 0 : (mismatch != EINVAL) ? 0 : (destroyed == CONCURRENCY))
+	 {
+		printf ("runtimes detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+ a: if (err)
+	 printf ("runtimes failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("runtimes failed with %lu of %lu results destroyed, %s selecting a busy runtime, and %s tethering across runtimes\n",
+				(unsigned long) destroyed, (unsigned long) CONCURRENCY, nthm_strerror (busy), nthm_strerror (mismatch));
+  exit (EXIT_FAILURE);
+}
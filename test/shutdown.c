@@ -0,0 +1,259 @@
+// test that nthm_shutdown truncates threads, waits for them until a deadline, and kills the rest
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include "testconfig.h"
+
+// number of threads of each kind to create
+#define CONCURRENCY 32
+
+// seconds to wait for threads that finish when truncated
+#define GRACE 2
+
+// number of results that have been passed to the destructor
+uintptr_t global_destroyed = 0;
+
+// number of threads that have opened all of their sources
+uintptr_t global_opened = 0;
+
+// set when a thread blocked reading a source that ignores killing has been woken
+int global_woken = 0;
+
+// set when the source that ignores killing may finish
+int global_released = 0;
+
+// used for mutually exclusive access to the globals
+pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+
+void
+destruction (result)
+	  void *result;
+
+	  // Free a result and count it.
+{
+  free (result);
+  pthread_mutex_lock (&global_lock);
+  global_destroyed++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+void *
+truncation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Wait until truncated and then return the operand.
+{
+  while (! nthm_truncated (err))
+	 sched_yield ();
+  return operand;
+}
+
+
+
+
+
+
+void *
+allocation (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Ignore truncation, wait until killed, and then return some
+	  // heap allocated storage.
+{
+  uintptr_t *result;
+
+  while (! nthm_killed (err))
+	 sched_yield ();
+  if ((result = (uintptr_t *) malloc (sizeof (*result))))
+	 *result = (uintptr_t) operand;
+  else
+	 *err = ENOMEM;
+  return (void *) result;
+}
+
+
+
+
+
+
+void
+opened ()
+
+	  // Count a thread that has opened all of its sources.
+{
+  pthread_mutex_lock (&global_lock);
+  global_opened++;
+  pthread_mutex_unlock (&global_lock);
+}
+
+
+
+
+
+
+int
+flag (f)
+	  int *f;
+
+	  // Safely read a global flag.
+{
+  int v;
+
+  pthread_mutex_lock (&global_lock);
+  v = *f;
+  pthread_mutex_unlock (&global_lock);
+  return v;
+}
+
+
+
+
+
+
+void *
+descent (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Open a thread that waits until killed and then wait until
+	  // killed as well.
+{
+  nthm_pipe source;
+
+  if ((source = nthm_open (&allocation, operand, err)))
+	 nthm_set_destructor (source, &destruction, err);
+  opened ();
+  return allocation (operand, err);
+}
+
+
+
+
+
+
+void *
+stubbornness (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Ignore both truncation and killing until released.
+{
+  while (! flag (&global_released))
+	 sched_yield ();
+  return operand;
+}
+
+
+
+
+
+
+void *
+obstruction (operand, err)
+	  void *operand;
+	  int *err;
+
+	  // Open a thread that ignores killing and block reading it, which
+	  // only being killed can interrupt.
+{
+  nthm_pipe source;
+
+  source = nthm_open (&stubbornness, operand, err);
+  opened ();
+  if (source)
+	 nthm_read (source, err);
+  pthread_mutex_lock (&global_lock);
+  global_woken = ! global_released;
+  pthread_mutex_unlock (&global_lock);
+  return NULL;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  nthm_pipe source[CONCURRENCY];
+  nthm_pipe p;
+  struct timespec deadline, now;
+  uintptr_t i, destroyed;
+  size_t remaining;
+  int err, refusal;
+
+  err = 0;
+  remaining = destroyed = 0;
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 {
+		source[i] = nthm_open (&truncation, (void *) i, &err);
+		if ((p = nthm_open (&allocation, (void *) i, &err)))
+		  nthm_set_destructor (p, &destruction, &err);
+		if ((p = nthm_open (&descent, (void *) i, &err)))
+		  nthm_set_destructor (p, &destruction, &err);
+		nthm_untether (p, &err);
+	 }
+  if (! err)
+	 nthm_open (&obstruction, NULL, &err);
+  pthread_mutex_lock (&global_lock);
+  while (err ? 0 : (global_opened < CONCURRENCY + 1))
+	 {
+		pthread_mutex_unlock (&global_lock);
+		sched_yield ();
+		pthread_mutex_lock (&global_lock);
+	 }
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : clock_gettime (CLOCK_REALTIME, &deadline) ? (err = errno) : 0)
+	 goto a;
+  deadline.tv_sec += GRACE;
+  if (! err)
+	 remaining = nthm_shutdown (&deadline, &err);
+  if (err ? 0 : clock_gettime (CLOCK_REALTIME, &deadline) ? (err = errno) : 0)
+	 goto a;
+  deadline.tv_sec += GRACE;
+  while (err ? 0 : flag (&global_woken) ? 0 : clock_gettime (CLOCK_REALTIME, &now) ? 0 : (now.tv_sec <= deadline.tv_sec))
+	 sched_yield ();
+  pthread_mutex_lock (&global_lock);
+  global_released = 1;
+  pthread_mutex_unlock (&global_lock);
+  refusal = 0;
+  if (! err)
+	 nthm_open (&truncation, NULL, &refusal);
+  for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+	 if ((uintptr_t) nthm_read (source[i], &err) != i)
+		err = (err ? err : EINVAL);
+  nthm_sync (&err);
+  pthread_mutex_lock (&global_lock);
+  destroyed = global_destroyed;
+  pthread_mutex_unlock (&global_lock);
+  if (err ? 0 : (refusal != NTHM_KILLED) ? 0 : (remaining != 3 * CONCURRENCY + 2) ? 0 : ! flag (&global_woken) ? 0 : (destroyed == 3 * CONCURRENCY))
+	 {
+		printf ("shutdown detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+ a: if (err)
+	 printf ("shutdown failed\n%s\n", nthm_strerror (err));
+  else
+	 printf ("shutdown failed with %lu of %lu threads remaining, %lu of %lu results destroyed, %s, and %s\n", (unsigned long) remaining, (unsigned long) (3 * CONCURRENCY + 2),
+				(unsigned long) destroyed, (unsigned long) (3 * CONCURRENCY), flag (&global_woken) ? "a blocked reader woken" : "a blocked reader left waiting", nthm_strerror (refusal));
+  exit (EXIT_FAILURE);
+}
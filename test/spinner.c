@@ -0,0 +1,98 @@
+// test reading and selecting with and without polling before sleeping
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "testconfig.h"
+
+// number of threads to create in each round
+#define CONCURRENCY 32
+
+// number of times to poll when polling is requested
+#define POLLS 4096UL
+
+// a little more arithmetic than it takes to start a thread
+#define WORK 0xffff
+
+
+
+
+uintptr_t
+worked (x, err)
+	  uintptr_t x;
+	  int *err;
+
+	  // Do some arithmetic and return its operand.
+{
+  uintptr_t i, total;
+
+  for (total = i = 0; i < WORK; total += i++);
+  return (total ? x : 0);
+}
+
+
+
+
+
+
+static uintptr_t
+round_trip (spin, err)
+	  int spin;
+	  int *err;
+
+	  // Open some threads and read half of them by selecting and half
+	  // explicitly, polling only if spin is non-zero. Return the sum
+	  // of their results.
+{
+  nthm_pipe source[CONCURRENCY];
+  unsigned long polls;
+  uintptr_t i, total;
+  nthm_pipe p;
+
+  polls = (spin ? POLLS : 0);
+  total = 0;
+  for (i = 0; *err ? 0 : (i < CONCURRENCY); i++)
+	 source[i] = nthm_open ((nthm_worker) &worked, (void *) i, err);
+  for (i = 0; *err ? 0 : (i < CONCURRENCY); i += 2)
+	 total += (uintptr_t) nthm_read_spin (source[i], polls, err);
+  while (*err ? NULL : (p = nthm_select_spin (polls, err)))
+	 total += (uintptr_t) nthm_read_spin (p, polls, err);
+  return total;
+}
+
+
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  struct nthm_statistics before, after;
+  uintptr_t expected;
+  int err;
+
+  err = 0;
+  expected = (CONCURRENCY * (CONCURRENCY - 1)) >> 1;
+  nthm_set_spin (POLLS, &err);
+  nthm_get_statistics (&before, &err);
+  if (err ? 1 : (round_trip (0, &err) != expected))
+	 goto a;
+  nthm_get_statistics (&after, &err);
+  if (err ? 1 : (after.polls != before.polls) ? 1 : (after.spun != before.spun))      // no polling was requested
+	 goto a;
+  if (err ? 1 : (round_trip (1, &err) != expected))
+	 goto a;
+  nthm_get_statistics (&after, &err);
+  if (err ? 1 : (after.waits < after.polls) ? 1 : (after.polls < after.spun))
+	 goto a;
+  if (err ? 1 : (after.waits < before.waits) ? 1 : (after.polls < before.polls) ? 1 : (after.spun < before.spun))
+	 goto a;
+  printf ("spinner detected no errors\n");
+  exit (EXIT_SUCCESS);
+ a: printf (err ? "spinner failed\n%s\n" : "spinner failed\n", nthm_strerror (err));
+  exit (EXIT_FAILURE);
+}
@@ -0,0 +1,57 @@
+// test eager initialization with preallocated structures
+
+#include <nthm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#define CONCURRENCY 64
+#define ROUNDS 8
+
+uintptr_t
+doubled (x, err)
+	  uintptr_t x;
+	  int *err;
+
+	  // Return twice the input.
+{
+  return x << 1;
+}
+
+
+
+
+int
+main(argc, argv)
+	  int argc;
+	  char **argv;
+{
+  struct nthm_config c;
+  uintptr_t i, round, total;
+  nthm_pipe source;
+  int err;
+
+  err = 0;
+  memset (&c, 0, sizeof (c));
+  c.pipes = CONCURRENCY + 1;               // one extra for the placeholder of the main thread
+  c.scopes = CONCURRENCY + 1;
+  c.pipe_lists = 2 * CONCURRENCY + 1;      // each tethered pipe needs two and the placeholder needs one
+  total = 0;
+  if (nthm_init (&c, &err) ? ! nthm_init (NULL, &err) : 1)
+	 goto a;
+  for (round = 0; err ? 0 : (round < ROUNDS); round++)  // the same preallocated structures are reused each round
+	 {
+		for (i = 0; err ? 0 : (i < CONCURRENCY); i++)
+		  nthm_open ((nthm_worker) &doubled, (void *) i, &err);
+		while (err ? NULL : (source = nthm_select (&err)))
+		  total += (uintptr_t) nthm_read (source, &err);
+	 }
+  if (err ? 0 : (total == ROUNDS * CONCURRENCY * (CONCURRENCY - 1)))
+	 {
+		printf ("warmup detected no errors\n");
+		exit (EXIT_SUCCESS);
+	 }
+ a: printf (err ? "warmup failed\n%s\n" : "warmup failed\n", nthm_strerror (err));
+  exit (EXIT_FAILURE);
+}